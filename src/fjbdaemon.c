@@ -22,6 +22,8 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+#include <linux/input.h>
+
 #include <X11/keysym.h>
 #include <X11/XF86keysym.h>
 
@@ -67,6 +69,15 @@ static struct FjbtndrvState {
 
 static guint current_time;
 
+/* read once at startup, the parameter is fixed at module load */
+static gboolean driver_sticky;
+
+/* gets the FN events fjbproxy sends, see on_key_events() */
+static FjbtndrvDisplay *key_display;
+
+/* of fjbproxy, replaced after a reconnect */
+static GDBusProxy *service_proxy;
+
 
 static void
 scroll_up(FjbtndrvDisplay *display)
@@ -198,6 +209,21 @@ toggle_lock_rotate(FjbtndrvDisplay *display)
 	}
 }
 
+/* older drivers have no parameter and are always sticky */
+static gboolean
+driver_sticky_modifiers(void)
+{
+	gchar *value;
+	gboolean sticky = TRUE;
+
+	if (g_file_get_contents(FJBTNDRV_STICKY_PARAMETER, &value, NULL, NULL)) {
+		sticky = (value[0] == 'Y' || value[0] == 'y' || value[0] == '1');
+		g_free(value);
+	}
+
+	return sticky;
+}
+
 static inline void
 button_pressed(FjbtndrvDeviceEvent *event)
 {
@@ -222,6 +248,14 @@ on_button_event(FjbtndrvDeviceEvent *event, gpointer user_data)
 		state.mode = NORMAL;
 	}
 
+	/* the driver latched the modifier and mapped this key already,
+	 * only the modes entered with the modifier keys are left here */
+	if ((driver_sticky) && (event->code != 37) && (event->code != 64) &&
+	    ((state.mode == STICKY_FN) || (state.mode == STICKY_ALT))) {
+		state.mode = NORMAL;
+		fjbtndrv_display_hide_osd(display);
+	}
+
 	switch (event->code) {
 	case 37:	/* FN */
 		if (event->value) {
@@ -425,6 +459,36 @@ on_button_event(FjbtndrvDeviceEvent *event, gpointer user_data)
 	state.key_time = 0;
 }
 
+/*
+ * X can't deliver KEY_FN, its keycode is above 255. Without the sticky
+ * modifiers of the driver the FN key comes from the KeyEvents signal of
+ * fjbproxy, as the keycode on_button_event() knows for it.
+ */
+static void
+on_key_events(GVariant *parameters)
+{
+	FjbtndrvDeviceEvent event;
+	GVariantIter *iter;
+	guint code;
+	gint value;
+	guint64 stamp;
+
+	if (driver_sticky || !key_display)
+		return;
+
+	g_variant_get(parameters, "(a(uit))", &iter);
+	while (g_variant_iter_loop(iter, "(uit)", &code, &value, &stamp)) {
+		/* no autorepeat for the modifier */
+		if (code != KEY_FN || value > 1)
+			continue;
+
+		event.code = 37;	/* FN */
+		event.value = value;
+		on_button_event(&event, key_display);
+	}
+	g_variant_iter_free(iter);
+}
+
 static void
 on_dbus_signal(GDBusProxy *proxy, char *sender, char *signal, GVariant *parameters, gpointer user_data)
 {
@@ -447,6 +511,9 @@ on_dbus_signal(GDBusProxy *proxy, char *sender, char *signal, GVariant *paramete
 		debug("DockStateChanged: state=%s",
 				data ? "true" : "false");
 	}
+	else if (g_strcmp0(signal, "KeyEvents") == 0) {
+		on_key_events(parameters);
+	}
 	else {
 		debug("unknown signal - %s", signal);
 		return;
@@ -456,23 +523,115 @@ on_dbus_signal(GDBusProxy *proxy, char *sender, char *signal, GVariant *paramete
 static void
 on_system_bus_connected(GObject *source, GAsyncResult *result, gpointer user_data)
 {
-	GDBusProxy *proxy;
 	GError *error = NULL;
 	GMainLoop *mainloop = (GMainLoop*) user_data;
 
 	debug("fjbtndrv_daemon_system_bus_ready: system bus connected");
 
-	proxy = g_dbus_proxy_new_for_bus_finish(result, &error);
+	service_proxy = g_dbus_proxy_new_for_bus_finish(result, &error);
 	if (error) {
 		g_error("%s", error->message);
 		g_error_free(error);
 		g_main_loop_quit(mainloop);
 	}
 
-	g_signal_connect(proxy, "g-signal",
+	g_signal_connect(service_proxy, "g-signal",
 			G_CALLBACK(on_dbus_signal), mainloop);
 }
 
+static void
+on_peer_proxy_ready(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GError *error = NULL;
+	GMainLoop *mainloop = (GMainLoop*) user_data;
+
+	service_proxy = g_dbus_proxy_new_finish(result, &error);
+	if (error) {
+		g_error("%s", error->message);
+		g_error_free(error);
+		g_main_loop_quit(mainloop);
+	}
+
+	g_signal_connect(service_proxy, "g-signal",
+			G_CALLBACK(on_dbus_signal), mainloop);
+}
+
+static void connect_proxy(GMainLoop *mainloop);
+
+/* fjbproxy went away, the system bus can start it again */
+static void
+on_peer_closed(GDBusConnection *connection, gboolean remote_peer_vanished, GError *error, gpointer user_data)
+{
+	debug("fjbtndrv_daemon_peer: connection closed");
+
+	if (service_proxy) {
+		g_object_unref(service_proxy);
+		service_proxy = NULL;
+	}
+
+	connect_proxy((GMainLoop*) user_data);
+}
+
+/*
+ * fjbproxy also listens on a private socket, signals from there skip
+ * the bus daemon. Without it the system bus is used.
+ */
+static void
+on_peer_connected(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GDBusConnection *connection;
+	GError *error = NULL;
+	GMainLoop *mainloop = (GMainLoop*) user_data;
+
+	connection = g_dbus_connection_new_for_address_finish(result, &error);
+	if (error) {
+		debug("fjbtndrv_daemon_peer: %s, using the system bus",
+				error->message);
+		g_error_free(error);
+
+		g_dbus_proxy_new_for_bus(
+				G_BUS_TYPE_SYSTEM,
+				G_DBUS_PROXY_FLAGS_NONE,
+				NULL,
+				FJBTNDRV_DBUS_SERVICE_NAME,
+				FJBTNDRV_DBUS_SERVICE_PATH,
+				FJBTNDRV_DBUS_SERVICE_INTERFACE,
+				NULL,
+				on_system_bus_connected,
+				mainloop);
+		return;
+	}
+
+	debug("fjbtndrv_daemon_peer: connected to %s", FJBTNDRV_PEER_ADDRESS);
+
+	g_signal_connect(connection, "closed",
+			G_CALLBACK(on_peer_closed), mainloop);
+
+	g_dbus_proxy_new(
+			connection,
+			G_DBUS_PROXY_FLAGS_NONE,
+			NULL,
+			NULL,
+			FJBTNDRV_DBUS_SERVICE_PATH,
+			FJBTNDRV_DBUS_SERVICE_INTERFACE,
+			NULL,
+			on_peer_proxy_ready,
+			mainloop);
+	g_object_unref(connection);
+}
+
+static void
+connect_proxy(GMainLoop *mainloop)
+{
+	g_dbus_connection_new_for_address(
+			FJBTNDRV_PEER_ADDRESS,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+			NULL,
+			NULL,
+			on_peer_connected,
+			mainloop);
+}
+
 // TODO
 static void
 load_config(void)
@@ -494,19 +653,12 @@ int main()
 	debug(" * initialization");
 
 	load_config();
+	driver_sticky = driver_sticky_modifiers();
+	debug(" * sticky modifiers: %s", driver_sticky ? "driver" : "daemon");
 
 	mainloop = g_main_loop_new(NULL, FALSE);
 
-	g_dbus_proxy_new_for_bus(
-			G_BUS_TYPE_SYSTEM,
-			G_DBUS_PROXY_FLAGS_NONE,
-			NULL,
-			FJBTNDRV_DBUS_SERVICE_NAME,
-			FJBTNDRV_DBUS_SERVICE_PATH,
-			FJBTNDRV_DBUS_SERVICE_INTERFACE,
-			NULL,
-			on_system_bus_connected,
-			mainloop);
+	connect_proxy(mainloop);
 
 	display = fjbtndrv_display_new(NULL);
 	if (!display) {
@@ -521,6 +673,7 @@ int main()
 	}
 
 	fjbtndrv_device_set_callback(device, on_button_event, display);
+	key_display = display;
 
 
 	debug(" * start");
@@ -532,6 +685,8 @@ int main()
 out:
 	debug(" * shutdown");
 
+	if (service_proxy)
+		g_object_unref(service_proxy);
 	if (display)
 		g_object_unref(display);
 
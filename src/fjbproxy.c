@@ -18,27 +18,70 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 #include <locale.h>
+#include <pwd.h>
+#include <grp.h>
 #include <glib.h>
 #include <gio/gio.h>
+#include <libudev.h>
 #include <linux/input.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <syslog.h>
 
 #include "fjbtndrv.h"
 
 #define BIT(n) (1UL << n)
+#define LONG_BITS (sizeof(long) * 8)
+#define NLONGS(n) (((n) + LONG_BITS - 1) / LONG_BITS)
+#define TEST_BIT(n, a) (((a)[(n) / LONG_BITS] >> ((n) % LONG_BITS)) & 1)
+
+/* events read per wakeup, evdev returns only whole events */
+#define EVENT_BUFFER_SIZE 64
+
+/* set by rules/95-fjbtndrv.rules on the event devices of the driver */
+#define FJBTNDRV_UDEV_TAG "fjbtndrv"
+
+/* seconds between attempts to get the bus name back */
+#define REOWN_DELAY 2
 
 static gboolean no_daemonize = FALSE;
 static gchar *device_file = NULL;
+static gint benchmark = 0;
+static gint idle_timeout = 0;
+static gchar *state_file = FJBTNDRV_STATE_FILE;
+static gchar *peer_socket = FJBTNDRV_PEER_SOCKET;
+static gchar *peer_group = FJBTNDRV_PEER_GROUP;
+static gint latency = 0;
 
 static const GOptionEntry options[] = {
-#ifdef DEBUG
 	{ "no-daemonize", 'f', 0, G_OPTION_ARG_NONE, &no_daemonize,
 	  "Do not daemonize, run in foreground", NULL },
-#endif
 	{ "device", 'd', 0, G_OPTION_ARG_FILENAME, &device_file,
-	  "input device file", NULL },
+	  "serve only this input device file, no hotplug", NULL },
+	{ "idle-timeout", 't', 0, G_OPTION_ARG_INT, &idle_timeout,
+	  "Exit after SECONDS without clients (0: never)", "SECONDS" },
+	{ "state-file", 's', 0, G_OPTION_ARG_FILENAME, &state_file,
+	  "shared state page, empty to disable", "FILE" },
+	{ "peer-socket", 'p', 0, G_OPTION_ARG_FILENAME, &peer_socket,
+	  "private D-Bus socket for local clients, empty to disable", "FILE" },
+	{ "peer-group", 'g', 0, G_OPTION_ARG_STRING, &peer_group,
+	  "group allowed on the private socket besides root", "GROUP" },
+	{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency,
+	  "Measure the latency of N test signals from a temporary private "
+	  "server and N unicast signals over the system bus, not the "
+	  "running proxy", "N" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_INT, &benchmark,
+	  "Replay the device file (or N synthetic events) without D-Bus, "
+	  "print the CPU time", "N" },
 	{ NULL }
 };
 
@@ -50,59 +93,228 @@ static const gchar introspection_xml[] =
 	"      <arg direction='out' name='value' type='b' />"
 	"    </signal>"
 	"    <property type='b' name='DockState' access='read' />"
+	"    <property type='s' name='StateFile' access='read' />"
+	"    <signal name='KeyEvents'>"
+	"      <arg direction='out' name='events' type='a(uit)' />"
+	"    </signal>"
 	"    <signal name='DockStateChanged'>"
 	"      <arg direction='out' name='value' type='b' />"
 	"    </signal>"
 	"  </interface>"
 	"</node>";
 
-static struct FjbtndrvSwitchStates {
+struct FjbtndrvSwitchStates {
+	gboolean tablet_mode;
+	gboolean dock_state;
+	gulong keys[NLONGS(KEY_CNT)];
+};
+
+/* switch events are collected up to the SYN_REPORT of their frame */
+#define FRAME_TABLET_MODE	BIT(0)
+#define FRAME_DOCK_STATE	BIT(1)
+
+struct FjbtndrvFrame {
+	gulong changed;
+	gboolean dropped;
 	gboolean tablet_mode;
 	gboolean dock_state;
-} state;
+	GArray *keys;		/* struct input_event */
+};
+
+/*
+ * One served event device. It is exported at
+ * FJBTNDRV_DBUS_SERVICE_PATH/<sysname>, the primary device also at
+ * FJBTNDRV_DBUS_SERVICE_PATH for the clients that know only one.
+ */
+typedef struct {
+	gchar *syspath;
+	gchar *devnode;
+	gchar *object_path;
+	GIOChannel *channel;
+	guint watch;
+	guint object_id;
+	guint primary_id;
+	struct FjbtndrvSwitchStates state;
+	struct FjbtndrvFrame frame;
+} FjbtndrvProxyDevice;
+
+static struct FjbtndrvStats {
+	gulong events;
+	gulong frames;
+	gulong updates;
+	gulong wakeups;
+	gulong resyncs;
+} stats;
 
 static GDBusNodeInfo *introspection_data = NULL;
 static GDBusConnection *dbus;
 static GMainLoop *mainloop;
 
+static guint owner_id;
+static gboolean owned_once;
+
+/* bus names of the clients seen, to their name watches */
+static GHashTable *clients;
+static guint idle_id;
+
+static GHashTable *devices;
+static FjbtndrvProxyDevice *primary;
+
+static struct udev *udev;
+static struct udev_monitor *monitor;
+
+static volatile struct fjbtndrv_state_page *state_page;
+
+/* private connections of local clients, they see the same objects */
+static GDBusServer *peer_server;
+static GSList *peers;
+static gid_t peer_gid = (gid_t) -1;
+
 
 static void
-dbus_emit_signal(const char *name, GVariant *parameters)
+emit_on(GDBusConnection *connection, FjbtndrvProxyDevice *device, const char *interface, const char *name, GVariant *parameters)
 {
 	GError *error = NULL;
 
-	g_return_if_fail (dbus);
-
-	debug("fjbtndrv_proxy_emit_signal: signal=%s parameters=%s",
-			name, g_variant_print(parameters, TRUE));
-
 	g_dbus_connection_emit_signal(
-			dbus,
+			connection,
 			NULL,
-			FJBTNDRV_DBUS_SERVICE_PATH,
-			FJBTNDRV_DBUS_SERVICE_INTERFACE,
+			device->object_path,
+			interface,
 			name,
 			parameters,
 			&error);
+	if (!error && device == primary)
+		g_dbus_connection_emit_signal(
+				connection,
+				NULL,
+				FJBTNDRV_DBUS_SERVICE_PATH,
+				interface,
+				name,
+				parameters,
+				&error);
 	if (error) {
 		g_warning("%s", error->message);
 		g_error_free(error);
 	}
 }
 
+/* the bus and the private connections get the same signals */
+static void
+dbus_emit(FjbtndrvProxyDevice *device, const char *interface, const char *name, GVariant *parameters)
+{
+	GSList *peer;
+
+	g_variant_ref_sink(parameters);
+
+#ifdef DEBUG
+	gchar *text = g_variant_print(parameters, TRUE);
+	debug("fjbtndrv_proxy_emit_signal: path=%s signal=%s parameters=%s",
+			device->object_path, name, text);
+	g_free(text);
+#endif
+
+	/* not yet exported, the properties have the state */
+	if (dbus && device->object_id)
+		emit_on(dbus, device, interface, name, parameters);
+
+	for (peer = peers; peer; peer = peer->next)
+		emit_on(peer->data, device, interface, name, parameters);
+
+	g_variant_unref(parameters);
+}
+
+static void
+dbus_emit_signal(FjbtndrvProxyDevice *device, const char *name, GVariant *parameters)
+{
+	dbus_emit(device, FJBTNDRV_DBUS_SERVICE_INTERFACE, name, parameters);
+}
+
+static gboolean
+on_idle_timeout(gpointer user_data)
+{
+	syslog(LOG_INFO, "no clients for %d seconds, exiting", idle_timeout);
+
+	idle_id = 0;
+	g_main_loop_quit(mainloop);
+	return FALSE;
+}
+
+/*
+ * (Re)starts the idle timer if nobody uses the proxy. Readers of the
+ * state page are not known, they see present = 0 after the exit and
+ * activate the service again.
+ */
+static void
+update_idle_timer(void)
+{
+	if (idle_id)
+		g_source_remove(idle_id);
+	idle_id = 0;
+
+	if (idle_timeout > 0 && g_hash_table_size(clients) == 0 && !peers)
+		idle_id = g_timeout_add_seconds(idle_timeout,
+				on_idle_timeout, NULL);
+}
+
+static void
+on_client_vanished(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	debug("on_client_vanished: name=%s", name);
+
+	g_hash_table_remove(clients, name);
+	update_idle_timer();
+}
+
+static void
+unwatch_client(gpointer watch)
+{
+	g_bus_unwatch_name(GPOINTER_TO_UINT(watch));
+}
+
+/*
+ * Signal subscriptions are not visible to the service, a client is
+ * whoever asked for a property (GDBusProxy does at creation) and stays
+ * one as long as it is on the bus.
+ */
+static void
+track_client(const gchar *sender)
+{
+	guint watch;
+
+	if (!sender || !dbus || g_hash_table_lookup(clients, sender))
+		return;
+
+	debug("track_client: name=%s", sender);
+
+	watch = g_bus_watch_name_on_connection(dbus, sender,
+			G_BUS_NAME_WATCHER_FLAGS_NONE,
+			NULL, on_client_vanished, NULL, NULL);
+	g_hash_table_insert(clients, g_strdup(sender), GUINT_TO_POINTER(watch));
+
+	update_idle_timer();
+}
+
 static GVariant *
 dbus_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name, const gchar *property_name, GError **error, gpointer user_data)
 {
+	FjbtndrvProxyDevice *device = user_data;
 	GVariant *value = NULL;
 
 	debug("handle_get_property: sender=%s path=%s interface=%s name=%s",
 			sender, object_path, interface_name, property_name);
 
+	track_client(sender);
+
 	if (g_strcmp0 (property_name, "TabletMode") == 0) {
-		value = g_variant_new_boolean(state.tablet_mode);
+		value = g_variant_new_boolean(device->state.tablet_mode);
 	}
 	else if (g_strcmp0 (property_name, "DockState") == 0) {
-		value = g_variant_new_boolean(state.dock_state);
+		value = g_variant_new_boolean(device->state.dock_state);
+	}
+	else if (g_strcmp0 (property_name, "StateFile") == 0) {
+		value = g_variant_new_string(
+				state_page && device == primary ? state_file : "");
 	}
 
 	return value;
@@ -115,239 +327,1501 @@ static const GDBusInterfaceVTable fjbtndrv_proxy_vtable = {
 };
 
 
-void
-set_tablet_mode(gboolean value)
+/*
+ * Maps the state page, readers only need a read-only mapping of their
+ * own and no IPC at all.
+ */
+static void
+open_state_page(void)
 {
-	debug("fjbtndrv_proxy_set_tablet_mode: value=%d", value);
+	gchar *dir;
+	gint fd;
+
+	if (!state_file || !*state_file)
+		return;
+
+	dir = g_path_get_dirname(state_file);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	fd = open(state_file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*state_page)) < 0) {
+		syslog(LOG_ERR, "failed to create %s - %s",
+				state_file, g_strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
 
-	GVariant *v_value = g_variant_new("(b)", value);
+	state_page = mmap(NULL, sizeof(*state_page), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
 
-	state.tablet_mode = value;
-	dbus_emit_signal("TabletModeChanged", v_value);
+	if (state_page == MAP_FAILED) {
+		syslog(LOG_ERR, "failed to map %s - %s",
+				state_file, g_strerror(errno));
+		state_page = NULL;
+		return;
+	}
 
-	g_variant_unref(v_value);
+	state_page->magic = FJBTNDRV_STATE_MAGIC;
 }
 
-void
-set_dock_state(gboolean value)
+/* seqlock writer, the sequence is odd while the fields change */
+static void
+write_state_page(FjbtndrvProxyDevice *device)
 {
-	debug("fjbtndrv_proxy_set_dock_state: value=%d", value);
+	if (!state_page)
+		return;
+
+	state_page->sequence++;
+	__sync_synchronize();
+
+	state_page->present = device != NULL;
+	state_page->tablet_mode = device ? device->state.tablet_mode : 0;
+	state_page->dock_state = device ? device->state.dock_state : 0;
+	state_page->updated = g_get_monotonic_time();
 
-	GVariant *v_value = g_variant_new("(b)", value);
+	__sync_synchronize();
+	state_page->sequence++;
+}
 
-	state.dock_state = value;
-	dbus_emit_signal("DockStateChanged", v_value);
+static void
+close_state_page(void)
+{
+	if (!state_page)
+		return;
 
-	g_variant_unref(v_value);
+	write_state_page(NULL);
+	munmap((void*) state_page, sizeof(*state_page));
+	state_page = NULL;
 }
 
 
 static void
-on_switch_event(struct input_event *event)
+set_tablet_mode(FjbtndrvProxyDevice *device, gboolean value)
 {
-	switch (event->code) {
-	case SW_TABLET_MODE:
-		set_tablet_mode(event->value);
-		break;
+	debug("fjbtndrv_proxy_set_tablet_mode: value=%d", value);
 
-	case SW_DOCK:
-		set_dock_state(event->value);
-		break;
-	}
+	device->state.tablet_mode = value;
+	dbus_emit_signal(device, "TabletModeChanged",
+			g_variant_new("(b)", value));
 }
 
-static gboolean
-on_event(GIOChannel *source, GIOCondition condition, gpointer user_data)
+static void
+set_dock_state(FjbtndrvProxyDevice *device, gboolean value)
 {
-	struct input_event event;
-	GIOStatus status;
-	GError *error = NULL;
+	debug("fjbtndrv_proxy_set_dock_state: value=%d", value);
+
+	device->state.dock_state = value;
+	dbus_emit_signal(device, "DockStateChanged",
+			g_variant_new("(b)", value));
+}
+
+/*
+ * Applies the switch values flagged in changed. Values equal to the
+ * known state are ignored, the others are signaled one by one and all
+ * together in a single PropertiesChanged.
+ */
+static void
+update_state(FjbtndrvProxyDevice *device, gulong changed, gboolean tablet_mode, gboolean dock_state)
+{
+	GVariantBuilder properties;
 
-	status = g_io_channel_read_chars(source, (gchar*) &event, sizeof(event),
-			NULL, &error);
+	if (tablet_mode == device->state.tablet_mode)
+		changed &= ~FRAME_TABLET_MODE;
+	if (dock_state == device->state.dock_state)
+		changed &= ~FRAME_DOCK_STATE;
 
-	switch (status) {
-	case G_IO_STATUS_NORMAL:
-		debug("input_event_dispatcher: timestamp=%lu.%lu  type=%04d code=%04d value=%d",
-				event.time.tv_sec, event.time.tv_usec, event.type, event.code, event.value);
+	if (!changed)
+		return;
 
-		switch (event.type) {
-		case EV_SW:
-			on_switch_event(&event);
-			break;
-		}
+	stats.updates++;
 
-		return TRUE;
+	g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
 
-	case G_IO_STATUS_ERROR:
-		g_error("%s", error->message);
-		g_error_free(error);
-	
-	default:
-		return FALSE;
+	if (changed & FRAME_TABLET_MODE) {
+		set_tablet_mode(device, tablet_mode);
+		g_variant_builder_add(&properties, "{sv}", "TabletMode",
+				g_variant_new_boolean(tablet_mode));
+	}
+	if (changed & FRAME_DOCK_STATE) {
+		set_dock_state(device, dock_state);
+		g_variant_builder_add(&properties, "{sv}", "DockState",
+				g_variant_new_boolean(dock_state));
 	}
+
+	if (device == primary)
+		write_state_page(device);
+
+	dbus_emit(device, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+			g_variant_new("(sa{sv}as)",
+				FJBTNDRV_DBUS_SERVICE_INTERFACE,
+				&properties, NULL));
 }
 
+
+/*
+ * Sends the key events of a frame as one KeyEvents signal of
+ * (code, value, timestamp in usec) tuples.
+ */
 static void
-on_bus_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+flush_key_events(FjbtndrvProxyDevice *device)
 {
-	GError *error = NULL;
-
-	debug("on_bus_acquired: name=%s", name);
+	GArray *keys = device->frame.keys;
+	GVariantBuilder events;
+	struct input_event *event;
+	guint i;
+
+	if (!keys->len)
+		return;
+
+	if ((dbus && device->object_id) || peers) {
+		g_variant_builder_init(&events, G_VARIANT_TYPE("a(uit)"));
+
+		for (i = 0; i < keys->len; i++) {
+			event = &g_array_index(keys, struct input_event, i);
+			g_variant_builder_add(&events, "(uit)",
+					event->code, event->value,
+					(guint64) event->time.tv_sec * G_USEC_PER_SEC +
+					event->time.tv_usec);
+		}
 
-	guint id = g_dbus_connection_register_object(
-			connection, 
-			FJBTNDRV_DBUS_SERVICE_PATH,
-			introspection_data->interfaces[0],
-			&fjbtndrv_proxy_vtable,
-			NULL, NULL, &error);
-	if (error)
-		g_error("%s", error->message);
+		dbus_emit_signal(device, "KeyEvents",
+				g_variant_new("(a(uit))", &events));
+	}
 
-	g_assert (id > 0);
+	g_array_set_size(keys, 0);
 }
 
 static void
-on_name_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+on_switch_event(FjbtndrvProxyDevice *device, struct input_event *event)
 {
-	debug("on_name_acquired: name=%s", name);
-	dbus = connection;
+	switch (event->code) {
+	case SW_TABLET_MODE:
+		device->frame.tablet_mode = event->value;
+		device->frame.changed |= FRAME_TABLET_MODE;
+		break;
+
+	case SW_DOCK:
+		device->frame.dock_state = event->value;
+		device->frame.changed |= FRAME_DOCK_STATE;
+		break;
+	}
 }
 
+/* the key state is updated at the end of the frame, see on_frame_end() */
 static void
-on_name_lost (GDBusConnection *connection, const gchar *name, gpointer user_data)
+on_key_event(FjbtndrvProxyDevice *device, struct input_event *event)
 {
-	debug("on_name_lost: name=%s", name);
-	dbus = NULL;
-	// TODO: reconnect
-	g_main_loop_quit(mainloop);
+	if (event->code >= KEY_CNT)
+		return;
+
+	g_array_append_val(device->frame.keys, *event);
 }
 
 /*
+ * Reads the current switch and key state from the device, after a
+ * SYN_DROPPED the events in the buffer can not be trusted anymore.
+ * Only switches and keys which differ from the last known state are
+ * signaled, keys with the time of the resync.
+ */
 static void
-on_device_lost(void)
+sync_device(FjbtndrvProxyDevice *device)
 {
-	debug("device lost");
-	g_main_loop_quit(mainloop);
+	gulong switches[NLONGS(SW_CNT)];
+	gulong keys[NLONGS(KEY_CNT)];
+	gint fd = g_io_channel_unix_get_fd(device->channel);
+	struct input_event event;
+	gint64 now;
+	guint i;
+
+	memset(switches, 0, sizeof(switches));
+	if (ioctl(fd, EVIOCGSW(sizeof(switches)), switches) >= 0)
+		update_state(device, FRAME_TABLET_MODE | FRAME_DOCK_STATE,
+				TEST_BIT(SW_TABLET_MODE, switches),
+				TEST_BIT(SW_DOCK, switches));
+
+	memset(keys, 0, sizeof(keys));
+	if (ioctl(fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+		now = g_get_real_time();
+
+		memset(&event, 0, sizeof(event));
+		event.type = EV_KEY;
+		event.time.tv_sec = now / G_USEC_PER_SEC;
+		event.time.tv_usec = now % G_USEC_PER_SEC;
+
+		for (i = 0; i < KEY_CNT; i++) {
+			if (TEST_BIT(i, keys) == TEST_BIT(i, device->state.keys))
+				continue;
+
+			debug("sync_device: key=%u value=%lu",
+					i, TEST_BIT(i, keys));
+
+			event.code = i;
+			event.value = TEST_BIT(i, keys);
+			g_array_append_val(device->frame.keys, event);
+		}
+
+		memcpy(device->state.keys, keys, sizeof(keys));
+		flush_key_events(device);
+	}
+}
+
+/* applies and sends the key and switch changes of a frame in one go */
+static void
+on_frame_end(FjbtndrvProxyDevice *device)
+{
+	gulong *keys = device->state.keys;
+	struct input_event *event;
+	guint i;
+
+	stats.frames++;
+
+	/* a frame cut off by SYN_DROPPED never gets here */
+	for (i = 0; i < device->frame.keys->len; i++) {
+		event = &g_array_index(device->frame.keys, struct input_event, i);
+		if (event->value)
+			keys[event->code / LONG_BITS] |= BIT(event->code % LONG_BITS);
+		else
+			keys[event->code / LONG_BITS] &= ~BIT(event->code % LONG_BITS);
+	}
+
+	flush_key_events(device);
+
+	if (!device->frame.changed)
+		return;
+
+	update_state(device, device->frame.changed,
+			device->frame.tablet_mode, device->frame.dock_state);
+	device->frame.changed = 0;
+}
+
+static void
+on_input_event(FjbtndrvProxyDevice *device, struct input_event *event)
+{
+	debug("input_event_dispatcher: timestamp=%lu.%lu  type=%04d code=%04d value=%d",
+			event->time.tv_sec, event->time.tv_usec, event->type, event->code, event->value);
+
+	stats.events++;
+
+	/*
+	 * The buffer of the device overflowed: drop the partial frame and
+	 * everything up to the next SYN_REPORT, then ask the device.
+	 */
+	if (event->type == EV_SYN && event->code == SYN_DROPPED) {
+		debug("input_event_dispatcher: events dropped");
+		device->frame.changed = 0;
+		device->frame.dropped = TRUE;
+		g_array_set_size(device->frame.keys, 0);
+		return;
+	}
+
+	if (device->frame.dropped) {
+		if (event->type == EV_SYN && event->code == SYN_REPORT) {
+			device->frame.dropped = FALSE;
+			stats.resyncs++;
+			sync_device(device);
+		}
+		return;
+	}
+
+	switch (event->type) {
+	case EV_KEY:
+		on_key_event(device, event);
+		break;
+
+	case EV_SW:
+		on_switch_event(device, event);
+		break;
+
+	case EV_SYN:
+		if (event->code == SYN_REPORT)
+			on_frame_end(device);
+		break;
+	}
 }
-*/
 
 
 static GIOChannel*
 open_device(const char* devname, GError **error)
 {
 	GIOChannel *gioc;
+	gint fd;
 
 	*error = NULL;
 
-#if 0
-	char *devname;
-
-	devname = getenv("DEVNAME");
-	if (devname == NULL) {
-		g_set_error(error, 0, 1, "DEVNAME not set.");
-		return NULL;
-	}
-#endif
-
 	syslog(LOG_DEBUG, "device file: %s", devname);
 
-	gioc = g_io_channel_new_file(devname, "r", error);
-	if (*error)
+	/* non-blocking, on_event() reads until EAGAIN */
+	fd = open(devname, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"%s: %s", devname, g_strerror(errno));
 		return NULL;
+	}
 
-	g_io_channel_set_encoding(gioc, NULL, error);
+	gioc = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(gioc, TRUE);
 
 	return gioc;
 }
 
-int
-main(int argc, char *argv[])
+static guint
+export_device(FjbtndrvProxyDevice *device, const gchar *path)
 {
-	GOptionContext *context;
-	GIOChannel *device = NULL;
 	GError *error = NULL;
+	guint id;
 
-	setlocale (LC_ALL, "");
+	id = g_dbus_connection_register_object(
+			dbus,
+			path,
+			introspection_data->interfaces[0],
+			&fjbtndrv_proxy_vtable,
+			device, NULL, &error);
+	if (error) {
+		syslog(LOG_ERR, "failed to export %s - %s",
+				path, error->message);
+		g_error_free(error);
+		return 0;
+	}
 
-	g_type_init();
+	return id;
+}
 
-	context = g_option_context_new ("fjbtndrv dbus proxy daemon");
-	g_option_context_add_main_entries (context, options, NULL);
-	g_option_context_parse (context, &argc, &argv, NULL);
+static void
+set_primary(FjbtndrvProxyDevice *device)
+{
+	if (primary && primary->primary_id && dbus)
+		g_dbus_connection_unregister_object(dbus, primary->primary_id);
+	if (primary)
+		primary->primary_id = 0;
 
-	if (!device_file) {
-		fprintf(stderr, "Syntax: %s --device <DEVICE>\n", argv[0]);
-		return 1;
-	}
+	primary = device;
+	write_state_page(device);
 
-	g_option_context_free (context);
+	if (device && device->object_id)
+		device->primary_id = export_device(device,
+				FJBTNDRV_DBUS_SERVICE_PATH);
+}
 
-	if (!no_daemonize)
-		if (daemon(0, 0) < 0)
-			return 0;
+/* (re)exports the devices after the bus name was acquired */
+static void
+export_devices(void)
+{
+	FjbtndrvProxyDevice *device;
+	GHashTableIter iter;
 
-	/* XXX: g_die() or {
-		GLogLevelFlags mask;
-		mask = g_log_set_always_fatal(G_LOG_FATAL_MASK);
-		mask |= G_LOG_LEVEL_CRITICAL;
-		g_log_set_always_fatal(mask);
-	} */
+	g_hash_table_iter_init(&iter, devices);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &device))
+		if (!device->object_id)
+			device->object_id = export_device(device,
+					device->object_path);
 
-	openlog("fjbproxy", LOG_PID | LOG_CONS, LOG_DAEMON);
+	set_primary(primary);
+}
 
-	debug(" * initialization");
+static void
+unexport_devices(void)
+{
+	FjbtndrvProxyDevice *device;
+	GHashTableIter iter;
+
+	g_hash_table_iter_init(&iter, devices);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &device)) {
+		if (device->primary_id)
+			g_dbus_connection_unregister_object(dbus,
+					device->primary_id);
+		if (device->object_id)
+			g_dbus_connection_unregister_object(dbus,
+					device->object_id);
+
+		device->primary_id = 0;
+		device->object_id = 0;
+	}
+}
 
-	introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+static gboolean on_event(GIOChannel *source, GIOCondition condition, gpointer user_data);
 
-	(void)g_bus_own_name (
-			G_BUS_TYPE_SYSTEM,
-			FJBTNDRV_DBUS_SERVICE_NAME,
-			G_BUS_NAME_OWNER_FLAGS_NONE,
-			on_bus_acquired,
-			on_name_acquired,
-			on_name_lost,
-			NULL,
-			NULL);
+static FjbtndrvProxyDevice*
+device_new(const gchar *syspath, const gchar *devnode, GError **error)
+{
+	FjbtndrvProxyDevice *device;
+	GIOChannel *channel;
+	gchar *sysname;
 
+	channel = open_device(devnode, error);
+	if (!channel)
+		return NULL;
 
-	mainloop = g_main_loop_new(NULL, FALSE);
+	device = g_new0(FjbtndrvProxyDevice, 1);
+	device->syspath = g_strdup(syspath);
+	device->devnode = g_strdup(devnode);
+	device->channel = channel;
+	device->frame.keys = g_array_new(FALSE, FALSE,
+			sizeof(struct input_event));
 
-	device = open_device(device_file, &error);
-	if (error) {
-		syslog(LOG_ERR, "failed to open device - %s", error->message);
-		goto out;
-	}
+	sysname = g_path_get_basename(syspath);
+	device->object_path = g_strconcat(FJBTNDRV_DBUS_SERVICE_PATH "/",
+			sysname, NULL);
+	g_free(sysname);
 
-	/* get and set initial switch states */
-	{
-		gulong switches = 0;
-		gint fd = g_io_channel_unix_get_fd(device);
+	/* initial switch and key states, not signaled before export */
+	sync_device(device);
 
-		if (ioctl(fd, EVIOCGSW(sizeof(switches)), &switches) >= 0) {
-			set_tablet_mode((switches & BIT(SW_TABLET_MODE)) >> SW_TABLET_MODE);
-			set_dock_state((switches & BIT(SW_DOCK)) >> SW_DOCK);
-		}
-	}
+	device->watch = g_io_add_watch(channel, G_IO_IN|G_IO_ERR|G_IO_HUP,
+			on_event, device);
 
-	g_io_add_watch(device, G_IO_IN|G_IO_ERR|G_IO_HUP,
-			(GIOFunc) on_event, NULL);
+	return device;
+}
 
-	debug(" * start");
+static void
+device_free(FjbtndrvProxyDevice *device)
+{
+	if (device->watch)
+		g_source_remove(device->watch);
+	if (device->object_id && dbus)
+		g_dbus_connection_unregister_object(dbus, device->object_id);
+
+	g_io_channel_unref(device->channel);
+	g_array_free(device->frame.keys, TRUE);
+	g_free(device->object_path);
+	g_free(device->devnode);
+	g_free(device->syspath);
+	g_free(device);
+}
 
-	g_main_loop_run(mainloop);
-	
+static gboolean
+device_free_stolen(gpointer key, gpointer value, gpointer user_data)
+{
+	device_free(value);
+	return TRUE;
+}
 
-out:
-	debug(" * shutdown");
+static void
+add_device(const gchar *syspath, const gchar *devnode)
+{
+	FjbtndrvProxyDevice *device;
+	GError *error = NULL;
 
-	if (mainloop)
-		g_main_loop_unref(mainloop);
-	if (device)
-		g_io_channel_unref(device);
+	/* enumeration and monitor can report the same device */
+	if (g_hash_table_lookup(devices, syspath))
+		return;
 
-	closelog();
+	device = device_new(syspath, devnode, &error);
+	if (!device) {
+		syslog(LOG_ERR, "failed to open device - %s", error->message);
+		g_error_free(error);
+		return;
+	}
 
-	return 0;
+	syslog(LOG_INFO, "serving %s at %s", devnode, device->object_path);
+
+	if (dbus)
+		device->object_id = export_device(device, device->object_path);
+	g_hash_table_insert(devices, device->syspath, device);
+
+	if (!primary)
+		set_primary(device);
 }
 
+static void
+remove_device(FjbtndrvProxyDevice *device)
+{
+	GHashTableIter iter;
+	gpointer next;
+
+	syslog(LOG_INFO, "removed %s", device->devnode);
+
+	g_hash_table_steal(devices, device->syspath);
+
+	if (device == primary) {
+		set_primary(NULL);
+
+		g_hash_table_iter_init(&iter, devices);
+		if (g_hash_table_iter_next(&iter, NULL, &next))
+			set_primary(next);
+	}
+
+	device_free(device);
+}
+
+static void
+on_device_lost(FjbtndrvProxyDevice *device)
+{
+	debug("device lost: %s", device->devnode);
+
+	/* the source is removed by returning FALSE */
+	device->watch = 0;
+
+	if (!monitor) {
+		g_main_loop_quit(mainloop);
+		return;
+	}
+
+	remove_device(device);
+}
+
+/* reads everything that is pending, not one event per wakeup */
+static gboolean
+on_event(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	FjbtndrvProxyDevice *device = user_data;
+	struct input_event events[EVENT_BUFFER_SIZE];
+	gint fd = g_io_channel_unix_get_fd(source);
+	ssize_t len;
+	gsize i;
+
+	stats.wakeups++;
+
+	for (;;) {
+		len = read(fd, events, sizeof(events));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
+			return TRUE;
+
+		if (len < 0) {
+			syslog(LOG_ERR, "failed to read device - %s",
+					g_strerror(errno));
+			on_device_lost(device);
+			return FALSE;
+		}
+
+		if (len == 0) {
+			on_device_lost(device);
+			return FALSE;
+		}
+
+		for (i = 0; i < (gsize) len / sizeof(*events); i++)
+			on_input_event(device, &events[i]);
+
+		/* a short read drained the buffer of the device */
+		if ((gsize) len < sizeof(events))
+			return TRUE;
+	}
+}
+
+
+static void
+on_udev_device(struct udev_device *udev_device)
+{
+	FjbtndrvProxyDevice *device;
+	const char *action, *syspath, *devnode;
+
+	action = udev_device_get_action(udev_device);
+	syspath = udev_device_get_syspath(udev_device);
+	devnode = udev_device_get_devnode(udev_device);
+
+	debug("on_udev_device: action=%s syspath=%s devnode=%s",
+			action, syspath, devnode);
+
+	if (g_strcmp0(action, "remove") == 0) {
+		device = g_hash_table_lookup(devices, syspath);
+		if (device)
+			remove_device(device);
+	}
+	/* no action means enumerated */
+	else if (!action || g_strcmp0(action, "add") == 0) {
+		if (devnode)
+			add_device(syspath, devnode);
+	}
+}
+
+static gboolean
+on_udev_event(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	struct udev_device *udev_device;
+
+	udev_device = udev_monitor_receive_device(monitor);
+	if (udev_device) {
+		on_udev_device(udev_device);
+		udev_device_unref(udev_device);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Watches the event devices tagged by the udev rule and adds the ones
+ * already present. The monitor is started first, so nothing added in
+ * between is missed.
+ */
+static gboolean
+start_udev(void)
+{
+	struct udev_enumerate *enumerate;
+	struct udev_list_entry *entry;
+	struct udev_device *udev_device;
+	GIOChannel *channel;
+
+	udev = udev_new();
+	if (!udev)
+		return FALSE;
+
+	monitor = udev_monitor_new_from_netlink(udev, "udev");
+	if (!monitor)
+		return FALSE;
+
+	udev_monitor_filter_add_match_subsystem_devtype(monitor, "input", NULL);
+	udev_monitor_filter_add_match_tag(monitor, FJBTNDRV_UDEV_TAG);
+	if (udev_monitor_enable_receiving(monitor) < 0)
+		return FALSE;
+
+	channel = g_io_channel_unix_new(udev_monitor_get_fd(monitor));
+	g_io_add_watch(channel, G_IO_IN, on_udev_event, NULL);
+	g_io_channel_unref(channel);
+
+	enumerate = udev_enumerate_new(udev);
+	udev_enumerate_add_match_subsystem(enumerate, "input");
+	udev_enumerate_add_match_tag(enumerate, FJBTNDRV_UDEV_TAG);
+	udev_enumerate_scan_devices(enumerate);
+
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+		udev_device = udev_device_new_from_syspath(udev,
+				udev_list_entry_get_name(entry));
+		if (!udev_device)
+			continue;
+
+		on_udev_device(udev_device);
+		udev_device_unref(udev_device);
+	}
+
+	udev_enumerate_unref(enumerate);
+	return TRUE;
+}
+
+static void
+stop_udev(void)
+{
+	if (monitor)
+		udev_monitor_unref(monitor);
+	if (udev)
+		udev_unref(udev);
+}
+
+
+static FjbtndrvProxyDevice*
+lookup_node(const gchar *node)
+{
+	FjbtndrvProxyDevice *device, *found = NULL;
+	GHashTableIter iter;
+	gchar *path;
+
+	if (!node)
+		return primary;
+
+	path = g_strconcat(FJBTNDRV_DBUS_SERVICE_PATH "/", node, NULL);
+
+	g_hash_table_iter_init(&iter, devices);
+	while (!found && g_hash_table_iter_next(&iter, NULL, (gpointer*) &device))
+		if (g_strcmp0(device->object_path, path) == 0)
+			found = device;
+
+	g_free(path);
+	return found;
+}
+
+static gchar **
+peer_enumerate(GDBusConnection *connection, const gchar *sender, const gchar *object_path, gpointer user_data)
+{
+	FjbtndrvProxyDevice *device;
+	GHashTableIter iter;
+	GPtrArray *nodes;
+
+	nodes = g_ptr_array_new();
+
+	g_hash_table_iter_init(&iter, devices);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer*) &device))
+		g_ptr_array_add(nodes, g_path_get_basename(device->object_path));
+
+	g_ptr_array_add(nodes, NULL);
+	return (gchar **) g_ptr_array_free(nodes, FALSE);
+}
+
+static GDBusInterfaceInfo **
+peer_introspect(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *node, gpointer user_data)
+{
+	GDBusInterfaceInfo **interfaces;
+
+	if (!lookup_node(node))
+		return NULL;
+
+	interfaces = g_new0(GDBusInterfaceInfo *, 2);
+	interfaces[0] = g_dbus_interface_info_ref(introspection_data->interfaces[0]);
+
+	return interfaces;
+}
+
+static const GDBusInterfaceVTable *
+peer_dispatch(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name, const gchar *node, gpointer *out_user_data, gpointer user_data)
+{
+	FjbtndrvProxyDevice *device = lookup_node(node);
+
+	if (!device)
+		return NULL;
+
+	*out_user_data = device;
+	return &fjbtndrv_proxy_vtable;
+}
+
+/* the devices come and go, a subtree follows them without bookkeeping */
+static const GDBusSubtreeVTable peer_subtree_vtable = {
+	peer_enumerate,
+	peer_introspect,
+	peer_dispatch,
+};
+
+static void
+on_peer_closed(GDBusConnection *connection, gboolean remote_peer_vanished, GError *error, gpointer user_data)
+{
+	debug("on_peer_closed: vanished=%d", remote_peer_vanished);
+
+	peers = g_slist_remove(peers, connection);
+	g_object_unref(connection);
+
+	update_idle_timer();
+}
+
+static gboolean
+on_new_peer(GDBusServer *server, GDBusConnection *connection, gpointer user_data)
+{
+	GError *error = NULL;
+
+	debug("on_new_peer");
+
+	g_dbus_connection_register_subtree(
+			connection,
+			FJBTNDRV_DBUS_SERVICE_PATH,
+			&peer_subtree_vtable,
+			G_DBUS_SUBTREE_FLAGS_NONE,
+			NULL, NULL, &error);
+	if (error) {
+		g_warning("%s", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	g_signal_connect(connection, "closed",
+			G_CALLBACK(on_peer_closed), NULL);
+	peers = g_slist_prepend(peers, g_object_ref(connection));
+
+	update_idle_timer();
+	return TRUE;
+}
+
+static gboolean
+in_peer_group(uid_t uid)
+{
+	struct passwd pw, *result;
+	gchar buf[1024];
+	gid_t *groups;
+	int i, n = 32;
+	gboolean found = FALSE;
+
+	if (peer_gid == (gid_t) -1)
+		return FALSE;
+
+	if (getpwuid_r(uid, &pw, buf, sizeof(buf), &result) || !result)
+		return FALSE;
+
+	groups = g_new(gid_t, n);
+	if (getgrouplist(pw.pw_name, pw.pw_gid, groups, &n) < 0) {
+		groups = g_renew(gid_t, groups, n);
+		if (getgrouplist(pw.pw_name, pw.pw_gid, groups, &n) < 0)
+			n = 0;
+	}
+
+	for (i = 0; i < n && !found; i++)
+		found = (groups[i] == peer_gid);
+
+	g_free(groups);
+	return found;
+}
+
+/*
+ * Root and the members of peer_group, the socket permissions already
+ * keep out the others. Called from a GDBus worker thread.
+ */
+static gboolean
+on_authorize_peer(GDBusAuthObserver *observer, GIOStream *stream, GCredentials *credentials, gpointer user_data)
+{
+	uid_t uid;
+
+	if (!credentials)
+		return FALSE;
+
+	uid = g_credentials_get_unix_user(credentials, NULL);
+	if (uid == (uid_t) -1)
+		return FALSE;
+
+	if (uid == 0 || in_peer_group(uid))
+		return TRUE;
+
+	syslog(LOG_NOTICE, "refused peer uid %u, not in group %s",
+			(guint) uid, peer_group);
+	return FALSE;
+}
+
+/*
+ * Listens on peer_socket for clients such as fjbdaemon, which then get
+ * the signals without the round trip through the bus daemon.
+ */
+static void
+start_server(void)
+{
+	GDBusAuthObserver *observer;
+	GError *error = NULL;
+	gchar *dir, *address, *guid;
+
+	if (!peer_socket || !*peer_socket)
+		return;
+
+	if (peer_group && *peer_group) {
+		struct group *gr = getgrnam(peer_group);
+
+		if (gr)
+			peer_gid = gr->gr_gid;
+		else
+			syslog(LOG_WARNING, "no group %s, only root may use %s",
+					peer_group, peer_socket);
+	}
+
+	dir = g_path_get_dirname(peer_socket);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	/* left over by a previous instance, this one owns the name */
+	unlink(peer_socket);
+
+	address = g_strconcat("unix:path=", peer_socket, NULL);
+	guid = g_dbus_generate_guid();
+	observer = g_dbus_auth_observer_new();
+	g_signal_connect(observer, "authorize-authenticated-peer",
+			G_CALLBACK(on_authorize_peer), NULL);
+
+	peer_server = g_dbus_server_new_sync(address, G_DBUS_SERVER_FLAGS_NONE,
+			guid, observer, NULL, &error);
+
+	g_object_unref(observer);
+	g_free(guid);
+	g_free(address);
+
+	if (error) {
+		syslog(LOG_ERR, "failed to listen on %s - %s",
+				peer_socket, error->message);
+		g_error_free(error);
+		return;
+	}
+
+	if (peer_gid != (gid_t) -1 && chown(peer_socket, 0, peer_gid) == 0)
+		chmod(peer_socket, 0660);
+	else
+		chmod(peer_socket, 0600);
+
+	g_signal_connect(peer_server, "new-connection",
+			G_CALLBACK(on_new_peer), NULL);
+	g_dbus_server_start(peer_server);
+}
+
+static void
+stop_server(void)
+{
+	GSList *peer;
+
+	if (!peer_server)
+		return;
+
+	g_dbus_server_stop(peer_server);
+	g_object_unref(peer_server);
+	peer_server = NULL;
+
+	unlink(peer_socket);
+
+	for (peer = peers; peer; peer = peer->next) {
+		g_signal_handlers_disconnect_by_func(peer->data,
+				on_peer_closed, NULL);
+		g_dbus_connection_close_sync(peer->data, NULL, NULL);
+		g_object_unref(peer->data);
+	}
+	g_slist_free(peers);
+	peers = NULL;
+}
+
+
+static guint own_name(void);
+
+static void
+on_bus_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	debug("on_bus_acquired: name=%s", name);
+
+	/* a restarted bus is handled in on_name_lost() */
+	g_dbus_connection_set_exit_on_close(connection, FALSE);
+}
+
+/* devices are opened only by the instance owning the name */
+static void
+on_name_acquired (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	debug("on_name_acquired: name=%s", name);
+	dbus = connection;
+
+	if (owned_once) {
+		syslog(LOG_INFO, "bus name %s reacquired", name);
+		export_devices();
+		return;
+	}
+
+	owned_once = TRUE;
+	update_idle_timer();
+
+	start_server();
+
+	if (device_file) {
+		add_device(device_file, device_file);
+		if (!primary)
+			g_main_loop_quit(mainloop);
+		return;
+	}
+
+	if (!start_udev()) {
+		syslog(LOG_ERR, "failed to monitor udev");
+		g_main_loop_quit(mainloop);
+	}
+}
+
+static gboolean
+on_reown(gpointer user_data)
+{
+	g_bus_unown_name(owner_id);
+	owner_id = own_name();
+	return FALSE;
+}
+
+/*
+ * Before the name was owned with a bus connection another instance
+ * serves the devices. Later the bus went away: the devices stay open
+ * and are exported again once the name is back.
+ */
+static void
+on_name_lost (GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	debug("on_name_lost: name=%s", name);
+
+	if (!owned_once && connection) {
+		g_main_loop_quit(mainloop);
+		return;
+	}
+
+	if (dbus) {
+		syslog(LOG_WARNING, "lost bus name %s, reacquiring", name);
+		unexport_devices();
+		g_hash_table_remove_all(clients);
+		update_idle_timer();
+		dbus = NULL;
+	}
+
+	g_timeout_add_seconds(REOWN_DELAY, on_reown, NULL);
+}
+
+/* a second instance gives up at once instead of queueing */
+static guint
+own_name(void)
+{
+	return g_bus_own_name (
+			G_BUS_TYPE_SYSTEM,
+			FJBTNDRV_DBUS_SERVICE_NAME,
+			G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+			on_bus_acquired,
+			on_name_acquired,
+			on_name_lost,
+			NULL,
+			NULL);
+}
+
+
+/*
+ * A high rate stream of scroll wheel frames with a tablet mode change
+ * in every 16th frame, written to a temporary file for the benchmark.
+ */
+static gchar*
+benchmark_stream(gint count, GError **error)
+{
+	struct input_event events[4];
+	gchar *filename;
+	gint fd, n, i, f;
+
+	fd = g_file_open_tmp("fjbproxy-XXXXXX", &filename, error);
+	if (fd < 0)
+		return NULL;
+
+	memset(events, 0, sizeof(events));
+
+	for (i = 0, f = 0; i < count; i += n, f++) {
+		n = 0;
+
+		if (f % 16 == 0) {
+			events[n].type = EV_SW;
+			events[n].code = SW_TABLET_MODE;
+			events[n++].value = (f / 16) & 1;
+		}
+
+		events[n].type = EV_MSC;
+		events[n].code = MSC_SCAN;
+		events[n++].value = 4;
+
+		events[n].type = EV_KEY;
+		events[n].code = KEY_SCROLLDOWN;
+		events[n++].value = !(f & 1);
+
+		events[n].type = EV_SYN;
+		events[n].code = SYN_REPORT;
+		events[n++].value = 0;
+
+		if (write(fd, events, n * sizeof(*events)) < 0) {
+			g_set_error(error, G_FILE_ERROR,
+					g_file_error_from_errno(errno),
+					"%s: %s", filename, g_strerror(errno));
+			close(fd);
+			unlink(filename);
+			g_free(filename);
+			return NULL;
+		}
+	}
+
+	close(fd);
+	return filename;
+}
+
+static gdouble
+cpu_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * Replays a recorded event stream (e.g. from cat /dev/input/eventX) or
+ * a synthetic one through the event path, without D-Bus.
+ */
+static int
+run_benchmark(void)
+{
+	FjbtndrvProxyDevice *device;
+	GError *error = NULL;
+	gchar *filename = NULL;
+	gdouble start, cpu;
+
+	if (!device_file) {
+		filename = benchmark_stream(benchmark, &error);
+		if (!filename) {
+			fprintf(stderr, "%s\n", error->message);
+			g_error_free(error);
+			return 1;
+		}
+	}
+
+	mainloop = g_main_loop_new(NULL, FALSE);
+
+	start = cpu_time();
+
+	device = device_new("benchmark", filename ? filename : device_file,
+			&error);
+	if (filename) {
+		unlink(filename);
+		g_free(filename);
+	}
+	if (!device) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	g_main_loop_run(mainloop);
+	cpu = cpu_time() - start;
+
+	printf("%lu events in %lu frames, %lu updates, %lu wakeups, %lu resyncs\n",
+			stats.events, stats.frames, stats.updates,
+			stats.wakeups, stats.resyncs);
+	printf("%.3f ms CPU time per 1000 events\n",
+			stats.events ? cpu * 1e6 / stats.events : 0.0);
+
+	device_free(device);
+	g_main_loop_unref(mainloop);
+	return 0;
+}
+
+/*
+ * Signal latency of a private connection and of the system bus, the two
+ * paths of fjbdaemon: a forked client receives KeyEvents carrying the
+ * monotonic send time, alternately over both, one every millisecond.
+ *
+ * This measures the transports, not a running fjbproxy: the private
+ * connection is to a temporary server without peer checks, and the bus
+ * signals are sent to the unique name of the client, which the default
+ * bus policy allows.  The real KeyEvents are broadcast, so the bus
+ * daemon also matches them against the rules of every other client.
+ */
+struct FjbtndrvLatency {
+	gint count;
+	gint64 sum;
+	gint64 max;
+};
+
+static struct FjbtndrvLatency peer_latency, bus_latency;
+static gint latency_expected;
+
+static GDBusConnection *latency_peer;
+static GDBusConnection *latency_bus;
+static gchar latency_dest[256];
+static gint latency_sent;
+static gint latency_status;
+
+static void
+on_latency_signal(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name, const gchar *signal_name, GVariant *parameters, gpointer user_data)
+{
+	struct FjbtndrvLatency *stat = user_data;
+	gint64 now = g_get_monotonic_time();
+	GVariantIter *events;
+	guint64 sent;
+	guint code;
+	gint value;
+
+	g_variant_get(parameters, "(a(uit))", &events);
+	while (g_variant_iter_next(events, "(uit)", &code, &value, &sent)) {
+		stat->count++;
+		stat->sum += now - (gint64) sent;
+		stat->max = MAX(stat->max, now - (gint64) sent);
+	}
+	g_variant_iter_free(events);
+
+	if (--latency_expected == 0)
+		g_main_loop_quit(mainloop);
+}
+
+static gboolean
+on_latency_timeout(gpointer user_data)
+{
+	fprintf(stderr, "timeout, %d signals missing\n", latency_expected);
+	g_main_loop_quit(mainloop);
+	return FALSE;
+}
+
+static void
+print_latency(const gchar *path, struct FjbtndrvLatency *stat)
+{
+	printf("%-8s %d signals, %.1f us average, %" G_GINT64_FORMAT " us max\n",
+			path, stat->count,
+			stat->count ? (gdouble) stat->sum / stat->count : 0.0,
+			stat->max);
+}
+
+static void
+subscribe_latency(GDBusConnection *connection, struct FjbtndrvLatency *stat)
+{
+	g_dbus_connection_signal_subscribe(connection, NULL,
+			FJBTNDRV_DBUS_SERVICE_INTERFACE, "KeyEvents",
+			FJBTNDRV_DBUS_SERVICE_PATH, NULL,
+			G_DBUS_SIGNAL_FLAGS_NONE,
+			on_latency_signal, stat, NULL);
+}
+
+/* the forked side, reads the server address and answers its bus name */
+static int
+latency_client(int in, int out)
+{
+	GDBusConnection *peer, *bus;
+	GError *error = NULL;
+	GVariant *reply;
+	gchar address[256];
+	const gchar *name = "-";
+	ssize_t len;
+
+	len = read(in, address, sizeof(address) - 1);
+	if (len <= 0)
+		return 1;
+	address[len] = '\0';
+
+	peer = g_dbus_connection_new_for_address_sync(address,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+			NULL, NULL, &error);
+	if (!peer) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	mainloop = g_main_loop_new(NULL, FALSE);
+
+	subscribe_latency(peer, &peer_latency);
+	latency_expected = latency;
+
+	bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+	if (bus) {
+		subscribe_latency(bus, &bus_latency);
+		latency_expected += latency;
+
+		/* replied after the AddMatch of the subscription */
+		reply = g_dbus_connection_call_sync(bus,
+				"org.freedesktop.DBus", "/org/freedesktop/DBus",
+				"org.freedesktop.DBus", "GetId", NULL, NULL,
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+		if (reply)
+			g_variant_unref(reply);
+
+		name = g_dbus_connection_get_unique_name(bus);
+	}
+
+	if (write(out, name, strlen(name)) < 0)
+		return 1;
+
+	g_timeout_add_seconds(10 + latency / 250, on_latency_timeout, NULL);
+	g_main_loop_run(mainloop);
+
+	printf("test signals, temporary server and unicast on the bus\n");
+	print_latency("private", &peer_latency);
+	if (bus)
+		print_latency("bus", &bus_latency);
+	else
+		printf("bus      no system bus\n");
+
+	/* the caller leaves with _exit() */
+	fflush(stdout);
+	return latency_expected ? 1 : 0;
+}
+
+static gboolean
+on_latency_peer(GDBusServer *server, GDBusConnection *connection, gpointer user_data)
+{
+	latency_peer = g_object_ref(connection);
+	return TRUE;
+}
+
+static void
+emit_latency(GDBusConnection *connection, const gchar *destination)
+{
+	GVariantBuilder events;
+
+	g_variant_builder_init(&events, G_VARIANT_TYPE("a(uit)"));
+	g_variant_builder_add(&events, "(uit)", KEY_SCROLLDOWN, 1,
+			(guint64) g_get_monotonic_time());
+
+	g_dbus_connection_emit_signal(connection, destination,
+			FJBTNDRV_DBUS_SERVICE_PATH,
+			FJBTNDRV_DBUS_SERVICE_INTERFACE, "KeyEvents",
+			g_variant_new("(a(uit))", &events), NULL);
+}
+
+static gboolean
+on_latency_tick(gpointer user_data)
+{
+	gint total = latency_bus ? 2 * latency : latency;
+
+	if (!latency_peer)
+		return TRUE;
+
+	if (latency_sent >= total)
+		return FALSE;
+
+	if (latency_bus && (latency_sent & 1))
+		emit_latency(latency_bus, latency_dest);
+	else
+		emit_latency(latency_peer, NULL);
+
+	latency_sent++;
+	return TRUE;
+}
+
+static gboolean
+on_latency_ready(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	ssize_t len;
+
+	len = read(g_io_channel_unix_get_fd(source), latency_dest,
+			sizeof(latency_dest) - 1);
+	if (len <= 0)
+		return FALSE;
+	latency_dest[len] = '\0';
+
+	/* the client has no system bus, measure the private path only */
+	if (latency_bus && latency_dest[0] == '-') {
+		g_object_unref(latency_bus);
+		latency_bus = NULL;
+	}
+
+	g_timeout_add(1, on_latency_tick, NULL);
+	return FALSE;
+}
+
+static void
+on_latency_done(GPid pid, gint status, gpointer user_data)
+{
+	latency_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+	g_main_loop_quit(mainloop);
+}
+
+static int
+run_latency(void)
+{
+	int to_client[2], to_server[2];
+	GDBusServer *server;
+	GIOChannel *ready;
+	GError *error = NULL;
+	gchar *dir, *path, *address, *guid;
+	pid_t pid;
+
+	if (pipe(to_client) < 0 || pipe(to_server) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	/* fork before GDBus starts its threads */
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(to_client[1]);
+		close(to_server[0]);
+		_exit(latency_client(to_client[0], to_server[1]));
+	}
+	close(to_client[0]);
+	close(to_server[1]);
+
+	dir = g_dir_make_tmp("fjbproxy-XXXXXX", &error);
+	if (!dir) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	path = g_build_filename(dir, "bus", NULL);
+	address = g_strconcat("unix:path=", path, NULL);
+	guid = g_dbus_generate_guid();
+
+	mainloop = g_main_loop_new(NULL, FALSE);
+
+	server = g_dbus_server_new_sync(address, G_DBUS_SERVER_FLAGS_NONE,
+			guid, NULL, NULL, &error);
+	if (!server) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		latency_status = 1;
+		goto out;
+	}
+
+	g_signal_connect(server, "new-connection",
+			G_CALLBACK(on_latency_peer), NULL);
+	g_dbus_server_start(server);
+
+	latency_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, NULL);
+
+	/* the server accepts from the main loop, do not block on the client */
+	ready = g_io_channel_unix_new(to_server[0]);
+	g_io_add_watch(ready, G_IO_IN|G_IO_HUP, on_latency_ready, NULL);
+	g_io_channel_unref(ready);
+
+	g_child_watch_add(pid, on_latency_done, NULL);
+
+	if (write(to_client[1], address, strlen(address)) < 0)
+		perror("write");
+
+	g_main_loop_run(mainloop);
+
+	g_dbus_server_stop(server);
+	g_object_unref(server);
+
+out:
+	if (latency_peer)
+		g_object_unref(latency_peer);
+	if (latency_bus)
+		g_object_unref(latency_bus);
+
+	unlink(path);
+	rmdir(dir);
+
+	g_main_loop_unref(mainloop);
+	g_free(guid);
+	g_free(address);
+	g_free(path);
+	g_free(dir);
+
+	return latency_status;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	GOptionContext *context;
+
+	setlocale (LC_ALL, "");
+
+	g_type_init();
+
+	context = g_option_context_new ("fjbtndrv dbus proxy daemon");
+	g_option_context_add_main_entries (context, options, NULL);
+	g_option_context_parse (context, &argc, &argv, NULL);
+	g_option_context_free (context);
+
+	if (benchmark)
+		return run_benchmark();
+	if (latency)
+		return run_latency();
+
+	if (!no_daemonize)
+		if (daemon(0, 0) < 0)
+			return 0;
+
+	/* XXX: g_die() or {
+		GLogLevelFlags mask;
+		mask = g_log_set_always_fatal(G_LOG_FATAL_MASK);
+		mask |= G_LOG_LEVEL_CRITICAL;
+		g_log_set_always_fatal(mask);
+	} */
+
+	openlog("fjbproxy", LOG_PID | LOG_CONS, LOG_DAEMON);
+
+	debug(" * initialization");
+
+	introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+
+	devices = g_hash_table_new(g_str_hash, g_str_equal);
+	clients = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, unwatch_client);
+
+	mainloop = g_main_loop_new(NULL, FALSE);
+
+	open_state_page();
+	owner_id = own_name();
+
+	debug(" * start");
+
+	g_main_loop_run(mainloop);
+
+
+	debug(" * shutdown");
+
+	set_primary(NULL);
+	g_hash_table_foreach_steal(devices, device_free_stolen, NULL);
+	g_hash_table_unref(devices);
+
+	stop_server();
+	stop_udev();
+	close_state_page();
+
+	g_hash_table_unref(clients);
+	g_bus_unown_name(owner_id);
+	g_main_loop_unref(mainloop);
+	g_dbus_node_info_unref(introspection_data);
+
+	closelog();
+
+	return 0;
+}
@@ -22,6 +22,8 @@
 #  include "../config.h"
 #endif
 
+#include <stdint.h>
+
 #ifdef DEBUG
 #  include <stdio.h>
 #  define debug(msg, a...) fprintf(stderr, msg "\n", ##a)
@@ -33,6 +35,74 @@
 #define FJBTNDRV_DBUS_SERVICE_NAME      "de.khnz.fjbtndrv"
 #define FJBTNDRV_DBUS_SERVICE_INTERFACE FJBTNDRV_DBUS_SERVICE_NAME
 
+/* private connection to fjbproxy, same objects as on the system bus */
+#define FJBTNDRV_PEER_SOCKET  "/run/fjbtndrv/bus"
+#define FJBTNDRV_PEER_ADDRESS "unix:path=" FJBTNDRV_PEER_SOCKET
+
+/* besides root only this group may connect, the others use the bus */
+#define FJBTNDRV_PEER_GROUP   "plugdev"
+
+/* Y if the driver handles the sticky modifiers, N if fjbdaemon does */
+#define FJBTNDRV_STICKY_PARAMETER "/sys/module/fujitsu_tablet/parameters/sticky"
+
+/*
+ * fjbproxy keeps the switch state of the primary device in this file,
+ * to be mapped read-only. The sequence is odd while an update is in
+ * progress, read it with fjbtndrv_state_read(). present is 0 also after
+ * an activated fjbproxy exited without clients, StartServiceByName()
+ * brings it back.
+ */
+#define FJBTNDRV_STATE_FILE "/run/fjbtndrv/state"
+#define FJBTNDRV_STATE_MAGIC 0x736a6266		/* "fbjs" */
+#define FJBTNDRV_STATE_TRIES 1000
+
+struct fjbtndrv_state_page {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t present;	/* 0 if no device is served */
+	uint32_t tablet_mode;
+	uint32_t dock_state;
+	uint32_t reserved;
+	int64_t updated;	/* g_get_monotonic_time() of the last change */
+};
+
+/*
+ * Returns -1 if no consistent copy was read within FJBTNDRV_STATE_TRIES
+ * tries, the writer may have died in the middle of an update. The caller
+ * should try again later.
+ */
+static inline int
+fjbtndrv_state_read(const volatile struct fjbtndrv_state_page *page,
+		struct fjbtndrv_state_page *state)
+{
+	uint32_t sequence;
+	int tries;
+
+	for (tries = 0; tries < FJBTNDRV_STATE_TRIES; tries++) {
+		sequence = page->sequence;
+		if (sequence & 1)
+			continue;
+		__sync_synchronize();
+
+		state->magic = page->magic;
+		state->present = page->present;
+		state->tablet_mode = page->tablet_mode;
+		state->dock_state = page->dock_state;
+		state->updated = page->updated;
+
+		__sync_synchronize();
+		if (page->sequence == sequence)
+			break;
+	}
+
+	if (tries == FJBTNDRV_STATE_TRIES)
+		return -1;
+
+	state->sequence = sequence;
+	state->reserved = 0;
+	return 0;
+}
+
 /*
 typedef struct {
 	unsigned int keycode;
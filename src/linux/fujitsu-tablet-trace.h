@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2012 Robert Gerlach <khnz@gmx.de>
+ *
+ * You can redistribute and/or modify this program under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fujitsu_tablet
+
+#if !defined(_FUJITSU_TABLET_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FUJITSU_TABLET_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(fujitsu_irq,
+	TP_PROTO(int irq, u8 status),
+	TP_ARGS(irq, status),
+	TP_STRUCT__entry(
+		__field(int, irq)
+		__field(u8, status)
+	),
+	TP_fast_assign(
+		__entry->irq = irq;
+		__entry->status = status;
+	),
+	TP_printk("irq=%d status=0x%02x", __entry->irq, __entry->status)
+);
+
+TRACE_EVENT(fujitsu_keymask,
+	TP_PROTO(unsigned long keymask, unsigned long changed),
+	TP_ARGS(keymask, changed),
+	TP_STRUCT__entry(
+		__field(u16, keymask)
+		__field(u16, changed)
+	),
+	TP_fast_assign(
+		__entry->keymask = keymask;
+		__entry->changed = changed;
+	),
+	TP_printk("keymask=0x%04x changed=0x%04x",
+		__entry->keymask, __entry->changed)
+);
+
+TRACE_EVENT(fujitsu_key,
+	TP_PROTO(unsigned int keycode, int pressed, int modifier),
+	TP_ARGS(keycode, pressed, modifier),
+	TP_STRUCT__entry(
+		__field(unsigned int, keycode)
+		__field(int, pressed)
+		__field(int, modifier)
+	),
+	TP_fast_assign(
+		__entry->keycode = keycode;
+		__entry->pressed = !!pressed;
+		__entry->modifier = modifier;
+	),
+	TP_printk("keycode=%u pressed=%d modifier=%d",
+		__entry->keycode, __entry->pressed, __entry->modifier)
+);
+
+TRACE_EVENT(fujitsu_modifier,
+	TP_PROTO(int old, int new),
+	TP_ARGS(old, new),
+	TP_STRUCT__entry(
+		__field(int, old)
+		__field(int, new)
+	),
+	TP_fast_assign(
+		__entry->old = old;
+		__entry->new = new;
+	),
+	TP_printk("modifier=%d -> %d", __entry->old, __entry->new)
+);
+
+TRACE_EVENT(fujitsu_sticky_timeout,
+	TP_PROTO(int modifier),
+	TP_ARGS(modifier),
+	TP_STRUCT__entry(
+		__field(int, modifier)
+	),
+	TP_fast_assign(
+		__entry->modifier = modifier;
+	),
+	TP_printk("modifier=%d", __entry->modifier)
+);
+
+TRACE_EVENT(fujitsu_sync,
+	TP_PROTO(u32 frame),
+	TP_ARGS(frame),
+	TP_STRUCT__entry(
+		__field(u32, frame)
+	),
+	TP_fast_assign(
+		__entry->frame = frame;
+	),
+	TP_printk("frame=%u", __entry->frame)
+);
+
+TRACE_EVENT(fujitsu_ready,
+	TP_PROTO(unsigned int msecs, int timeout),
+	TP_ARGS(msecs, timeout),
+	TP_STRUCT__entry(
+		__field(unsigned int, msecs)
+		__field(int, timeout)
+	),
+	TP_fast_assign(
+		__entry->msecs = msecs;
+		__entry->timeout = timeout;
+	),
+	TP_printk("msecs=%u timeout=%d", __entry->msecs, __entry->timeout)
+);
+
+#endif /* _FUJITSU_TABLET_TRACE_H */
+
+/* this header lives outside of include/trace/events */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fujitsu-tablet-trace
+#include <trace/define_trace.h>
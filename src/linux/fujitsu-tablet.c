@@ -27,8 +27,27 @@
 #include <linux/interrupt.h>
 #include <linux/input.h>
 #include <linux/timer.h>
-#include <linux/delay.h>
 #include <linux/dmi.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/sysfs.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <linux/hrtimer.h>
+#include <linux/async.h>
+#include <linux/kobject.h>
+
+#define CREATE_TRACE_POINTS
+#include "fujitsu-tablet-trace.h"
 
 #define MODULENAME "fujitsu-tablet"
 
@@ -39,6 +58,72 @@
 
 #define KEYMAP_LEN 16
 
+#ifndef MSC_TIMESTAMP
+#define MSC_TIMESTAMP 0x05
+#endif
+
+/* bits of fujitsu->notify */
+#define NOTIFY_DOCK        0
+#define NOTIFY_TABLET_MODE 1
+
+/* the controller is polled until it is ready after a reset */
+#define RESET_POLL_MSECS 20
+#define RESET_POLL_TRIES 50
+
+/* log2 histograms in usecs, the last bucket takes everything above */
+#define HIST_LEN 24
+
+static unsigned int inject;
+module_param(inject, uint, S_IRUGO);
+MODULE_PARM_DESC(inject, "Number of virtual devices fed through debugfs");
+
+/* without it the modifier keys are reported as plain keys, fjbdaemon
+ * reads it once, so it is fixed at load time */
+static bool sticky = true;
+module_param(sticky, bool, S_IRUGO);
+MODULE_PARM_DESC(sticky, "Handle sticky FN/ALT modifiers in the driver");
+
+/* used if the _CRS has no interrupt */
+static unsigned int poll_fast = 5;
+module_param(poll_fast, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_fast, "Poll interval while keys are active (ms)");
+
+static unsigned int poll_idle = 100;
+module_param(poll_idle, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_idle, "Poll interval while idle (ms)");
+
+static unsigned int poll_active = 1000;
+module_param(poll_active, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_active, "Keep polling fast this long after an event (ms)");
+
+/* only used for keys with a gesture keycode, see fujitsu_gesture() */
+static unsigned int gesture_long = 800;
+module_param(gesture_long, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gesture_long, "Minimum duration of a long press (ms)");
+
+static unsigned int gesture_double = 300;
+module_param(gesture_double, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gesture_double, "Maximum pause of a double press (ms)");
+
+static unsigned int gesture_chord = 80;
+module_param(gesture_chord, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gesture_chord, "Maximum delay between the keys of a chord (ms)");
+
+/* keymap bits (as in the inject file) of keys which are not reported,
+ * e.g. because hands rest on the lid in laptop mode.  Every device copies
+ * them at probe, later they are changed through its sysfs files. */
+static unsigned int inhibit_laptop;
+module_param(inhibit_laptop, uint, S_IRUGO);
+MODULE_PARM_DESC(inhibit_laptop, "Keys ignored in laptop mode (keymap bits)");
+
+static unsigned int inhibit_tablet;
+module_param(inhibit_tablet, uint, S_IRUGO);
+MODULE_PARM_DESC(inhibit_tablet, "Keys ignored in tablet mode (keymap bits)");
+
+static unsigned int inhibit_dock;
+module_param(inhibit_dock, uint, S_IRUGO);
+MODULE_PARM_DESC(inhibit_dock, "Keys ignored while docked (keymap bits)");
+
 static const struct acpi_device_id fujitsu_ids[] = {
 	{ .id = "FUJ02BD" },
 	{ .id = "FUJ02BF" },
@@ -137,14 +222,60 @@ static unsigned short modifier_keycode[MODIFIER_MAX] = {
 	KEY_LEFTALT
 };
 
+/* gesture keycodes, KEY_RESERVED if unused */
+struct fujitsu_gestures {
+	unsigned short hold[KEYMAP_LEN];	/* long press */
+	unsigned short twice[KEYMAP_LEN];	/* double press */
+	unsigned short chord[KEYMAP_LEN][KEYMAP_LEN]; /* [lower][higher] */
+	unsigned long keys;	/* keymap bits with any gesture */
+	unsigned long chords;	/* keymap bits with a chord */
+};
+
 struct fujitsu_config {
 	keymap_entry keymap[KEYMAP_LEN];
 	unsigned int quirks;
+	struct fujitsu_gestures gestures;
+	struct rcu_head rcu;
+};
+
+/*
+ * The keymap sysfs file, independent of struct fujitsu_config: for every
+ * keymap bit MODIFIER_MAX keycodes (no modifier, FN, ALT) as little
+ * endian 16 bit words, then the quirks as a little endian 32 bit word.
+ */
+#define FUJITSU_KEYMAP_FILE_KEYS	(KEYMAP_LEN * MODIFIER_MAX)
+#define FUJITSU_KEYMAP_FILE_SIZE \
+	(FUJITSU_KEYMAP_FILE_KEYS * sizeof(__le16) + sizeof(__le32))
+
+/*
+ * EVIOCSKEYCODE scancodes, also reported as MSC_SCAN:
+ *
+ *    0 -  47  keymap bit plus 16 times the modifier column
+ *   48 -  63  long press of a keymap bit
+ *   64 -  79  double press of a keymap bit
+ *   80 - 335  chord, 80 plus 16 times the lower plus the higher bit
+ */
+#define SCANCODE_HOLD		(KEYMAP_LEN * MODIFIER_MAX)
+#define SCANCODE_TWICE		(SCANCODE_HOLD + KEYMAP_LEN)
+#define SCANCODE_CHORD		(SCANCODE_TWICE + KEYMAP_LEN)
+#define FUJITSU_SCANCODE_MAX	(SCANCODE_CHORD + KEYMAP_LEN * KEYMAP_LEN)
+
+enum fujitsu_gesture_state {
+	GESTURE_IDLE,
+	GESTURE_DOWN,	/* held back, a chord is still possible */
+	GESTURE_HELD,	/* held back, waiting for a long press */
+	GESTURE_UP,	/* held back, waiting for a double press */
+	GESTURE_DONE,	/* gesture reported, waiting for the releases */
 };
 
-static struct {
+/* selected by dmi_check_system(), copied into every device */
+static struct fujitsu_config fujitsu_config;
+
+struct fujitsu_tablet {
+	struct list_head list;
+	struct device *dev;		/* acpi device, NULL if virtual */
 	struct input_dev *idev;
-	struct fujitsu_config config;
+	struct fujitsu_config __rcu *config;	/* private copy, RCU */
 	unsigned long prev_keymask;
 
 	char phys[21];
@@ -152,69 +283,693 @@ static struct {
 	int irq;
 	int io_base;
 	int io_length;
-
-	unsigned short prev_key;
-	keymap_modifier modifier;
-	int modifier_down;
+	spinlock_t io_lock;	/* the register index and the event regs */
+	u8 event_state;		/* registers read before the last ack */
+	unsigned long event_keymask;
+
+	int dock;
+	int tablet_mode;
+	u8 raw_state;		/* state register before the quirks */
+	int sysfs_dock;		/* last states sent to sysfs and udev */
+	int sysfs_tablet_mode;
+	unsigned long notify;	/* NOTIFY_*, sent after the frame */
+
+	struct delayed_work reset_work;
+	unsigned long reset_start;
+	int reset_tries;
+
+	/* modifier state, under lock like the frames it is reported in */
+	keymap_modifier modifier;	/* active modifier (keymap column) */
+	int modifier_down;		/* modifier keys held down */
+	unsigned short prev_key;	/* last pressed key, 0 if released */
+	int sticky_pending;		/* sticky timeout is armed */
+	unsigned long sticky_expires;
 	struct timer_list sticky_timer;
-} fujitsu;
+	struct work_struct sticky_work;
+
+	ktime_t irq_time;	/* entry of the last hard irq */
+	ktime_t frame_time;	/* MSC_TIMESTAMP of the next frame, under lock */
+	int frame_events;	/* events of the next frame, under lock */
+
+	/* polling mode, without an interrupt */
+	struct hrtimer poll_timer;
+	struct work_struct poll_work;
+	unsigned long poll_event;	/* jiffies of the last event */
+	unsigned long poll_window;	/* start of the poll rate window */
+	u32 poll_window_count;
+	int poll_stop;
+
+	/* gestures, changed under lock */
+	enum fujitsu_gesture_state gesture_state;
+	int gesture_bit;		/* the held back key */
+	unsigned long gesture_done;	/* keys of the reported gesture */
+	ktime_t gesture_start;
+	u32 gesture_seq;		/* changed on every timer start/cancel */
+	u32 gesture_armed;		/* gesture_seq of the running timer */
+	u32 gesture_fired;		/* gesture_armed of the expired timer */
+	struct hrtimer gesture_timer;
+	struct work_struct gesture_work;
+
+	/* inhibited keys, see fujitsu_inhibit_mask() */
+	int inhibited;			/* all keys, set through sysfs */
+	unsigned int inhibit_laptop;	/* keymap bits, set through sysfs */
+	unsigned int inhibit_tablet;
+	unsigned int inhibit_dock;
+	unsigned long raw_keymask;	/* as read, with the inhibited keys */
+
+	struct {
+		u32 handled;	/* interrupts handled by the irq thread */
+		u32 spurious;	/* interrupts of other devices */
+		u32 inhibited;	/* handled with only inhibited key changes */
+		u32 unchanged;	/* handled without any change */
+		u32 switch_only; /* frames with only switch changes */
+		u32 key_frames;	/* frames with key changes */
+		u32 sticky;	/* sticky timer runs */
+		u32 gestures;	/* reported gestures */
+		u32 frames;	/* input frames (SYN_REPORT) sent */
+		u32 ready_ms;	/* controller ready time of the last reset */
+		u32 polls;	/* poll timer runs */
+		u32 poll_rate;	/* poll timer runs in the last second */
+		u32 duration[HIST_LEN];	/* hard irq entry to thread end */
+		u32 interval[HIST_LEN];	/* between hard irqs */
+	} stats;
+	struct dentry *debugfs;
+	struct mutex lock;	/* serializes irq thread, inject and reset */
+};
 
-static u8 fujitsu_ack(void)
+static LIST_HEAD(fujitsu_virtual_devices);
+static struct dentry *fujitsu_debugfs;
+
+static u8 fujitsu_ack(struct fujitsu_tablet *fujitsu)
+{
+	return inb(fujitsu->io_base + 2);
+}
+
+static u8 fujitsu_status(struct fujitsu_tablet *fujitsu)
 {
-	return inb(fujitsu.io_base + 2);
+	return inb(fujitsu->io_base + 6);
 }
 
-static u8 fujitsu_status(void)
+static u8 fujitsu_read_register(struct fujitsu_tablet *fujitsu, const u8 addr)
 {
-	return inb(fujitsu.io_base + 6);
+	unsigned long flags;
+	u8 value;
+
+	spin_lock_irqsave(&fujitsu->io_lock, flags);
+	outb(addr, fujitsu->io_base);
+	value = inb(fujitsu->io_base + 4);
+	spin_unlock_irqrestore(&fujitsu->io_lock, flags);
+
+	return value;
 }
 
-static u8 fujitsu_read_register(const u8 addr)
+static unsigned long fujitsu_read_keymask(struct fujitsu_tablet *fujitsu)
 {
-	outb(addr, fujitsu.io_base);
-	return inb(fujitsu.io_base + 4);
+	unsigned long keymask;
+
+	keymask  = fujitsu_read_register(fujitsu, 0xde);
+	keymask |= fujitsu_read_register(fujitsu, 0xdf) << 8;
+	return keymask ^ 0xffff;
+}
+
+/*
+ * The event registers are read before the ack, the controller may
+ * latch the next event once it is acked.  Called from the hard irq and
+ * the poll timer, the irq thread takes the values with the io_lock.
+ */
+static void fujitsu_read_event(struct fujitsu_tablet *fujitsu)
+{
+	unsigned long flags, keymask;
+	u8 state;
+
+	state = fujitsu_read_register(fujitsu, 0xdd);
+	keymask = fujitsu_read_keymask(fujitsu);
+
+	spin_lock_irqsave(&fujitsu->io_lock, flags);
+	fujitsu->event_state = state;
+	fujitsu->event_keymask = keymask;
+	spin_unlock_irqrestore(&fujitsu->io_lock, flags);
+
+	fujitsu_ack(fujitsu);
 }
 
-static void fujitsu_send_state(void)
+static void fujitsu_hist_add(u32 *hist, ktime_t delta)
 {
-	int state;
+	s64 us = ktime_to_us(delta);
+	int bucket = 0;
+
+	if (us > 0)
+		bucket = min(fls64(us), HIST_LEN - 1);
+
+	hist[bucket]++;
+}
+
+/* like the input core, which drops keys and switches without a change */
+static void fujitsu_event(struct fujitsu_tablet *fujitsu,
+		unsigned int type, unsigned int code, int value)
+{
+	struct input_dev *idev = fujitsu->idev;
+
+	if (type == EV_KEY && (!test_bit(code, idev->keybit) ||
+			       !!test_bit(code, idev->key) == !!value))
+		return;
+
+	if (type == EV_SW && (!test_bit(code, idev->swbit) ||
+			      !!test_bit(code, idev->sw) == !!value))
+		return;
+
+	fujitsu->frame_events++;
+	input_event(idev, type, code, value);
+}
+
+/*
+ * Every frame carries the time of the hard irq (or of the timer) which
+ * caused it as MSC_TIMESTAMP, in usecs of the monotonic clock.  The
+ * value wraps like the one of other drivers.
+ */
+static void fujitsu_sync(struct fujitsu_tablet *fujitsu)
+{
+	/* a timestamp alone must not make a frame */
+	if (!fujitsu->frame_events)
+		return;
+
+	input_event(fujitsu->idev, EV_MSC, MSC_TIMESTAMP,
+			(u32) ktime_to_us(fujitsu->frame_time));
+	fujitsu->frame_events = 0;
+
+	fujitsu->stats.frames++;
+	trace_fujitsu_sync(fujitsu->stats.frames);
+	input_sync(fujitsu->idev);
+}
+
+/*
+ * The switch states are also attributes of the acpi device, so they can
+ * be read without opening the event device.  Changes wake up poll() on
+ * the attributes and send a change uevent.  Not used by virtual devices.
+ */
+static ssize_t fujitsu_dock_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct fujitsu_tablet *fujitsu = acpi_driver_data(to_acpi_device(dev));
+
+	return sprintf(buf, "%d\n", ACCESS_ONCE(fujitsu->sysfs_dock));
+}
+
+static ssize_t fujitsu_tablet_mode_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct fujitsu_tablet *fujitsu = acpi_driver_data(to_acpi_device(dev));
+
+	return sprintf(buf, "%d\n", ACCESS_ONCE(fujitsu->sysfs_tablet_mode));
+}
+
+static DEVICE_ATTR(dock, S_IRUGO, fujitsu_dock_show, NULL);
+static DEVICE_ATTR(tablet_mode, S_IRUGO, fujitsu_tablet_mode_show, NULL);
+
+static struct attribute *fujitsu_attrs[] = {
+	&dev_attr_dock.attr,
+	&dev_attr_tablet_mode.attr,
+	NULL
+};
+
+static const struct attribute_group fujitsu_attr_group = {
+	.attrs = fujitsu_attrs,
+};
+
+/* under lock, the change is sent by fujitsu_notify_state() */
+static void fujitsu_set_sysfs_state(struct fujitsu_tablet *fujitsu,
+		int dock, int tablet_mode)
+{
+	if (!fujitsu->dev)
+		return;
+
+	if (dock != fujitsu->sysfs_dock) {
+		fujitsu->sysfs_dock = dock;
+		set_bit(NOTIFY_DOCK, &fujitsu->notify);
+	}
+
+	if (tablet_mode != fujitsu->sysfs_tablet_mode) {
+		fujitsu->sysfs_tablet_mode = tablet_mode;
+		set_bit(NOTIFY_TABLET_MODE, &fujitsu->notify);
+	}
+}
+
+/* without lock, after the frame with the switch events was sent */
+static void fujitsu_notify_state(struct fujitsu_tablet *fujitsu)
+{
+	struct kobject *kobj;
+	unsigned long notify;
+	char dock_env[16], tablet_mode_env[24];
+	char *envp[] = { dock_env, tablet_mode_env, NULL };
+
+	notify = xchg(&fujitsu->notify, 0);
+	if (!notify)
+		return;
+	kobj = &fujitsu->dev->kobj;
+
+	if (notify & BIT(NOTIFY_DOCK))
+		sysfs_notify(kobj, NULL, "dock");
+	if (notify & BIT(NOTIFY_TABLET_MODE))
+		sysfs_notify(kobj, NULL, "tablet_mode");
+
+	snprintf(dock_env, sizeof(dock_env), "DOCK=%d",
+			ACCESS_ONCE(fujitsu->sysfs_dock));
+	snprintf(tablet_mode_env, sizeof(tablet_mode_env), "TABLET_MODE=%d",
+			ACCESS_ONCE(fujitsu->sysfs_tablet_mode));
+	kobject_uevent_env(kobj, KOBJ_CHANGE, envp);
+}
+
+/* returns 1 if switch events were reported, the caller has to sync */
+static int fujitsu_send_state(struct fujitsu_tablet *fujitsu, u8 state)
+{
+	unsigned int quirks;
 	int dock, tablet_mode;
 
-	state = fujitsu_read_register(0xdd);
+	rcu_read_lock();
+	quirks = rcu_dereference(fujitsu->config)->quirks;
+	rcu_read_unlock();
+
+	/* for a later change of the quirks */
+	fujitsu->raw_state = state;
 
-	dock = state & 0x02;
+	dock = !!(state & 0x02);
 
-	if ((fujitsu.config.quirks & FORCE_TABLET_MODE_IF_UNDOCK) && (!dock)) {
+	if ((quirks & FORCE_TABLET_MODE_IF_UNDOCK) && (!dock)) {
 		tablet_mode = 1;
 	} else{
 		tablet_mode = state & 0x01;
-		if (fujitsu.config.quirks & INVERT_TABLET_MODE_BIT)
+		if (quirks & INVERT_TABLET_MODE_BIT)
 			tablet_mode = !tablet_mode;
 	}
 
-	input_report_switch(fujitsu.idev, SW_DOCK, dock);
-	input_report_switch(fujitsu.idev, SW_TABLET_MODE, tablet_mode);
-	input_sync(fujitsu.idev);
+	/* most interrupts are button events, don't resend unchanged
+	 * switch states */
+	if (dock == fujitsu->dock && tablet_mode == fujitsu->tablet_mode)
+		return 0;
+
+	fujitsu_set_sysfs_state(fujitsu, dock, tablet_mode);
+
+	fujitsu->dock = dock;
+	fujitsu->tablet_mode = tablet_mode;
+
+	fujitsu_event(fujitsu, EV_SW, SW_DOCK, dock);
+	fujitsu_event(fujitsu, EV_SW, SW_TABLET_MODE, tablet_mode);
+	return 1;
+}
+
+static void fujitsu_reset_work(struct work_struct *work)
+{
+	struct fujitsu_tablet *fujitsu = container_of(to_delayed_work(work),
+			struct fujitsu_tablet, reset_work);
+	int busy;
+
+	busy = fujitsu_status(fujitsu) & 0x02;
+	if (busy && --fujitsu->reset_tries) {
+		schedule_delayed_work(&fujitsu->reset_work,
+				msecs_to_jiffies(RESET_POLL_MSECS));
+		return;
+	}
+
+	fujitsu->stats.ready_ms =
+		jiffies_to_msecs(jiffies - fujitsu->reset_start);
+	trace_fujitsu_ready(fujitsu->stats.ready_ms, busy);
+
+	mutex_lock(&fujitsu->lock);
+	fujitsu->frame_time = ktime_get();
+
+	/* force a report of the current switch states */
+	fujitsu->dock = -1;
+	fujitsu->tablet_mode = -1;
+	if (fujitsu_send_state(fujitsu, fujitsu_read_register(fujitsu, 0xdd)))
+		fujitsu_sync(fujitsu);
+
+	mutex_unlock(&fujitsu->lock);
+
+	fujitsu_notify_state(fujitsu);
+}
+
+/*
+ * The controller needs up to a second after a resume.  Don't wait for
+ * it here, the switch states are reported by the work once it is ready.
+ */
+static void fujitsu_reset(struct fujitsu_tablet *fujitsu)
+{
+	fujitsu_ack(fujitsu);
+
+	fujitsu->reset_start = jiffies;
+	fujitsu->reset_tries = RESET_POLL_TRIES;
+	schedule_delayed_work(&fujitsu->reset_work, 0);
+}
+
+static int fujitsu_keymap_index(const struct input_keymap_entry *ke,
+		unsigned int *index)
+{
+	unsigned int scancode;
+
+	if (ke->flags & INPUT_KEYMAP_BY_INDEX) {
+		*index = ke->index;
+	} else {
+		if (input_scancode_to_scalar(ke, &scancode))
+			return -EINVAL;
+		*index = scancode;
+	}
+
+	if (*index >= FUJITSU_SCANCODE_MAX)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* NULL for the unused half of the chord table */
+static unsigned short *fujitsu_keymap_entry(struct fujitsu_config *config,
+		unsigned int index)
+{
+	unsigned int lower, higher;
+
+	if (index < SCANCODE_HOLD)
+		return &config->keymap[index % KEYMAP_LEN][index / KEYMAP_LEN];
+	if (index < SCANCODE_TWICE)
+		return &config->gestures.hold[index - SCANCODE_HOLD];
+	if (index < SCANCODE_CHORD)
+		return &config->gestures.twice[index - SCANCODE_TWICE];
+
+	lower = (index - SCANCODE_CHORD) / KEYMAP_LEN;
+	higher = (index - SCANCODE_CHORD) % KEYMAP_LEN;
+	if (lower >= higher)
+		return NULL;
+
+	return &config->gestures.chord[lower][higher];
+}
+
+static int fujitsu_keymap_uses(struct fujitsu_config *config,
+		unsigned int keycode)
+{
+	unsigned short *entry;
+	unsigned int i;
+
+	for (i = 0; i < FUJITSU_SCANCODE_MAX; i++) {
+		entry = fujitsu_keymap_entry(config, i);
+		if (entry && *entry == keycode)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void fujitsu_config_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct fujitsu_config, rcu));
+}
+
+/*
+ * Every device has its own copy of the config.  It is never changed in
+ * place: writers build a new copy and swap the pointer under the input
+ * device's event_lock, readers only need rcu_read_lock().
+ *
+ * Called with event_lock held, takes over the new config.
+ */
+static void fujitsu_replace_config(struct fujitsu_tablet *fujitsu,
+		struct fujitsu_config *config)
+{
+	struct fujitsu_gestures *g = &config->gestures;
+	struct fujitsu_config *old;
+	unsigned short *entry;
+	unsigned int i, j;
+
+	old = rcu_dereference_protected(fujitsu->config,
+			lockdep_is_held(&fujitsu->idev->event_lock));
+
+	for (i = 0; i < FUJITSU_SCANCODE_MAX; i++) {
+		entry = fujitsu_keymap_entry(config, i);
+		if (entry)
+			__set_bit(*entry, fujitsu->idev->keybit);
+	}
+	__clear_bit(KEY_RESERVED, fujitsu->idev->keybit);
+
+	g->keys = g->chords = 0;
+	for (i = 0; i < KEYMAP_LEN; i++) {
+		if (g->hold[i] || g->twice[i])
+			g->keys |= BIT(i);
+
+		for (j = i + 1; j < KEYMAP_LEN; j++)
+			if (g->chord[i][j])
+				g->chords |= BIT(i) | BIT(j);
+	}
+	g->keys |= g->chords;
+
+	rcu_assign_pointer(fujitsu->config, config);
+	call_rcu(&old->rcu, fujitsu_config_free_rcu);
+}
+
+static int fujitsu_getkeycode(struct input_dev *idev,
+		struct input_keymap_entry *ke)
+{
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(idev);
+	unsigned short *entry;
+	unsigned int index;
+	int error;
+
+	error = fujitsu_keymap_index(ke, &index);
+	if (error)
+		return error;
+
+	rcu_read_lock();
+	entry = fujitsu_keymap_entry(rcu_dereference(fujitsu->config), index);
+	ke->keycode = entry ? *entry : KEY_RESERVED;
+	rcu_read_unlock();
+
+	ke->index = index;
+	ke->len = sizeof(index);
+	memcpy(ke->scancode, &index, sizeof(index));
+	return 0;
 }
 
-static void fujitsu_reset(void)
+/* called by the input core with event_lock held */
+static int fujitsu_setkeycode(struct input_dev *idev,
+		const struct input_keymap_entry *ke, unsigned int *old_keycode)
 {
-	int timeout = 50;
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(idev);
+	struct fujitsu_config *config;
+	unsigned short *entry;
+	unsigned int index;
+	int error;
 
-	fujitsu_ack();
+	error = fujitsu_keymap_index(ke, &index);
+	if (error)
+		return error;
 
-	while ((fujitsu_status() & 0x02) && (--timeout))
-		msleep(20);
+	config = kmemdup(rcu_dereference_protected(fujitsu->config,
+			lockdep_is_held(&idev->event_lock)),
+			sizeof(*config), GFP_ATOMIC);
+	if (!config)
+		return -ENOMEM;
 
-	fujitsu_send_state();
+	entry = fujitsu_keymap_entry(config, index);
+	if (!entry) {
+		kfree(config);
+		return -EINVAL;
+	}
+
+	*old_keycode = *entry;
+	*entry = ke->keycode;
+
+	/* the input core releases the old key if it is gone now */
+	if (!fujitsu_keymap_uses(config, *old_keycode))
+		__clear_bit(*old_keycode, idev->keybit);
+
+	fujitsu_replace_config(fujitsu, config);
+	return 0;
+}
+
+static ssize_t fujitsu_keymap_read(struct file *file, struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct device *dev = container_of(kobj, struct device, kobj);
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(to_input_dev(dev));
+	struct fujitsu_config *config;
+	__le16 keys[FUJITSU_KEYMAP_FILE_KEYS];
+	__le32 quirks;
+	char data[FUJITSU_KEYMAP_FILE_SIZE];
+	int i, j;
+
+	if (off >= FUJITSU_KEYMAP_FILE_SIZE)
+		return 0;
+	if (count > FUJITSU_KEYMAP_FILE_SIZE - off)
+		count = FUJITSU_KEYMAP_FILE_SIZE - off;
+
+	rcu_read_lock();
+	config = rcu_dereference(fujitsu->config);
+	for (i = 0; i < KEYMAP_LEN; i++)
+		for (j = 0; j < MODIFIER_MAX; j++)
+			keys[i * MODIFIER_MAX + j] =
+				cpu_to_le16(config->keymap[i][j]);
+	quirks = cpu_to_le32(config->quirks);
+	rcu_read_unlock();
+
+	memcpy(data, keys, sizeof(keys));
+	memcpy(data + sizeof(keys), &quirks, sizeof(quirks));
+	memcpy(buf, data + off, count);
+
+	return count;
 }
 
-static int __devinit input_fujitsu_setup(struct device *parent,
-					 const char *name, const char *phys)
+/*
+ * The whole keymap and the quirks are replaced with a single write, so
+ * an interrupt sees either the old or the new config but never a mix.
+ * Keycodes which are no longer used stay in the capabilities, gesture
+ * keycodes are kept.  If the quirks changed, the switch states are
+ * evaluated again from the last state register value.
+ */
+static ssize_t fujitsu_keymap_write(struct file *file, struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct device *dev = container_of(kobj, struct device, kobj);
+	struct input_dev *idev = to_input_dev(dev);
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(idev);
+	struct fujitsu_config *config, *old;
+	__le16 keys[FUJITSU_KEYMAP_FILE_KEYS];
+	__le32 quirks;
+	unsigned long flags;
+	int requirk;
+	int i, j;
+
+	if (off != 0 || count != FUJITSU_KEYMAP_FILE_SIZE)
+		return -EINVAL;
+
+	config = kzalloc(sizeof(*config), GFP_KERNEL);
+	if (!config)
+		return -ENOMEM;
+
+	memcpy(keys, buf, sizeof(keys));
+	memcpy(&quirks, buf + sizeof(keys), sizeof(quirks));
+
+	for (i = 0; i < KEYMAP_LEN; i++)
+		for (j = 0; j < MODIFIER_MAX; j++)
+			config->keymap[i][j] =
+				le16_to_cpu(keys[i * MODIFIER_MAX + j]);
+	config->quirks = le32_to_cpu(quirks);
+
+	if (config->quirks & ~(INVERT_TABLET_MODE_BIT |
+				FORCE_TABLET_MODE_IF_UNDOCK))
+		goto err_inval;
+
+	for (i = 0; i < KEYMAP_LEN; i++)
+		for (j = 0; j < MODIFIER_MAX; j++)
+			if (config->keymap[i][j] > KEY_MAX)
+				goto err_inval;
+
+	/* the irq thread takes the event_lock under it as well */
+	mutex_lock(&fujitsu->lock);
+
+	spin_lock_irqsave(&idev->event_lock, flags);
+	old = rcu_dereference_protected(fujitsu->config,
+			lockdep_is_held(&idev->event_lock));
+	requirk = old->quirks != config->quirks;
+	config->gestures = old->gestures;
+	fujitsu_replace_config(fujitsu, config);
+	spin_unlock_irqrestore(&idev->event_lock, flags);
+
+	if (requirk) {
+		fujitsu->frame_time = ktime_get();
+		if (fujitsu_send_state(fujitsu, fujitsu->raw_state))
+			fujitsu_sync(fujitsu);
+	}
+
+	mutex_unlock(&fujitsu->lock);
+
+	fujitsu_notify_state(fujitsu);
+	return count;
+
+err_inval:
+	kfree(config);
+	return -EINVAL;
+}
+
+static struct bin_attribute fujitsu_keymap_attr = {
+	.attr  = { .name = "keymap", .mode = S_IRUGO | S_IWUSR },
+	.size  = FUJITSU_KEYMAP_FILE_SIZE,
+	.read  = fujitsu_keymap_read,
+	.write = fujitsu_keymap_write,
+};
+
+/* like the inhibited attribute of newer input cores, but for the keys
+ * only, the switches are still reported */
+static ssize_t fujitsu_inhibited_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(to_input_dev(dev));
+
+	return sprintf(buf, "%d\n", ACCESS_ONCE(fujitsu->inhibited));
+}
+
+static ssize_t fujitsu_inhibited_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(to_input_dev(dev));
+	bool inhibited;
+
+	if (strtobool(buf, &inhibited))
+		return -EINVAL;
+
+	/* keys pressed before are still released */
+	fujitsu->inhibited = inhibited;
+	return count;
+}
+
+static DEVICE_ATTR(inhibited, S_IRUGO | S_IWUSR,
+		fujitsu_inhibited_show, fujitsu_inhibited_store);
+
+/* inhibit_laptop, inhibit_tablet and inhibit_dock of this device */
+#define FUJITSU_INHIBIT_ATTR(_mode)					\
+static ssize_t fujitsu_inhibit_##_mode##_show(struct device *dev,	\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(to_input_dev(dev)); \
+									\
+	return sprintf(buf, "0x%04x\n",				\
+			ACCESS_ONCE(fujitsu->inhibit_##_mode));	\
+}									\
+									\
+static ssize_t fujitsu_inhibit_##_mode##_store(struct device *dev,	\
+		struct device_attribute *attr, const char *buf, size_t count) \
+{									\
+	struct fujitsu_tablet *fujitsu = input_get_drvdata(to_input_dev(dev)); \
+	unsigned int mask;						\
+									\
+	if (kstrtouint(buf, 0, &mask) || mask > 0xffff)			\
+		return -EINVAL;						\
+									\
+	fujitsu->inhibit_##_mode = mask;				\
+	return count;							\
+}									\
+									\
+static DEVICE_ATTR(inhibit_##_mode, S_IRUGO | S_IWUSR,			\
+		fujitsu_inhibit_##_mode##_show,				\
+		fujitsu_inhibit_##_mode##_store)
+
+FUJITSU_INHIBIT_ATTR(laptop);
+FUJITSU_INHIBIT_ATTR(tablet);
+FUJITSU_INHIBIT_ATTR(dock);
+
+static struct attribute *fujitsu_input_attrs[] = {
+	&dev_attr_inhibited.attr,
+	&dev_attr_inhibit_laptop.attr,
+	&dev_attr_inhibit_tablet.attr,
+	&dev_attr_inhibit_dock.attr,
+	NULL
+};
+
+static const struct attribute_group fujitsu_input_attr_group = {
+	.attrs = fujitsu_input_attrs,
+};
+
+static int __devinit input_fujitsu_setup(struct fujitsu_tablet *fujitsu,
+		struct device *parent, const char *name, const char *phys)
 {
 	struct input_dev *idev;
+	struct fujitsu_config *config;
 	int error;
-	int i;
+	int i, j;
 
 	idev = input_allocate_device();
 	if (!idev)
@@ -228,20 +983,23 @@ static int __devinit input_fujitsu_setup(struct device *parent,
 	idev->id.product = 0x0001;
 	idev->id.version = 0x0101;
 
-	idev->keycode = fujitsu.config.keymap;
-	idev->keycodesize = sizeof(fujitsu.config.keymap[0]);
-	idev->keycodemax = ARRAY_SIZE(fujitsu.config.keymap);
+	idev->keycodesize = sizeof(unsigned short);
+	idev->keycodemax = FUJITSU_SCANCODE_MAX;
+	idev->getkeycode = fujitsu_getkeycode;
+	idev->setkeycode = fujitsu_setkeycode;
+	input_set_drvdata(idev, fujitsu);
 
 	__set_bit(EV_REP, idev->evbit);
 
-	for (i = 0; i < ARRAY_SIZE(fujitsu.config.keymap); i++) {
-		input_set_capability(idev, EV_KEY, fujitsu.config.keymap[i][0]);
-		input_set_capability(idev, EV_KEY, fujitsu.config.keymap[i][1]);
-		input_set_capability(idev, EV_KEY, fujitsu.config.keymap[i][2]);
-	}
+	/* not registered yet, no one else can replace the config */
+	config = rcu_dereference_protected(fujitsu->config, 1);
+	for (i = 0; i < KEYMAP_LEN; i++)
+		for (j = 0; j < MODIFIER_MAX; j++)
+			input_set_capability(idev, EV_KEY, config->keymap[i][j]);
 
 	input_set_capability(idev, EV_MSC, MSC_SCAN);
 	input_set_capability(idev, EV_MSC, MSC_RAW);
+	input_set_capability(idev, EV_MSC, MSC_TIMESTAMP);
 
 	input_set_capability(idev, EV_SW, SW_DOCK);
 	input_set_capability(idev, EV_SW, SW_TABLET_MODE);
@@ -252,58 +1010,107 @@ static int __devinit input_fujitsu_setup(struct device *parent,
 		return error;
 	}
 
-	fujitsu.idev = idev;
+	error = sysfs_create_bin_file(&idev->dev.kobj, &fujitsu_keymap_attr);
+	if (error) {
+		input_unregister_device(idev);
+		return error;
+	}
+
+	error = sysfs_create_group(&idev->dev.kobj, &fujitsu_input_attr_group);
+	if (error) {
+		sysfs_remove_bin_file(&idev->dev.kobj, &fujitsu_keymap_attr);
+		input_unregister_device(idev);
+		return error;
+	}
+
+	fujitsu->idev = idev;
 	return 0;
 }
 
-static void input_fujitsu_remove(void)
+static void input_fujitsu_remove(struct fujitsu_tablet *fujitsu)
 {
-	input_unregister_device(fujitsu.idev);
+	sysfs_remove_group(&fujitsu->idev->dev.kobj, &fujitsu_input_attr_group);
+	sysfs_remove_bin_file(&fujitsu->idev->dev.kobj, &fujitsu_keymap_attr);
+	input_unregister_device(fujitsu->idev);
 }
 
-static void fujitsu_set_modifier(keymap_modifier modifier)
+/* returns 1 if events were reported, the caller has to sync */
+static int fujitsu_report_modifier(struct fujitsu_tablet *fujitsu,
+		keymap_modifier old, keymap_modifier new)
 {
-//	unsigned short keycode;
+	if (old == new)
+		return 0;
 
-	printk(KERN_DEBUG MODULENAME ": fujitsu_set_modifier: modifier is %d, will set to %d\n",
-			fujitsu.modifier, modifier);
+	trace_fujitsu_modifier(old, new);
 
-	if (fujitsu.modifier) {
-		printk(KERN_DEBUG MODULENAME ": fujitsu_set_modifier: release: 0\n");
-		input_event(fujitsu.idev, EV_MSC, MSC_RAW, 0);
-		input_sync(fujitsu.idev);
-	}
+	if (old)
+		fujitsu_event(fujitsu, EV_MSC, MSC_RAW, 0);
 
-	if (modifier) {
-		printk(KERN_DEBUG MODULENAME ": fujitsu_set_modifier: pressed: %d\n", modifier);
-		input_event(fujitsu.idev, EV_MSC, MSC_RAW, modifier);
-		input_sync(fujitsu.idev);
-	}
+	if (new)
+		fujitsu_event(fujitsu, EV_MSC, MSC_RAW, new);
+
+	return 1;
+}
+
+static void fujitsu_sticky_modifier_timeout(unsigned long data)
+{
+	struct fujitsu_tablet *fujitsu = (struct fujitsu_tablet *) data;
 
-	fujitsu.modifier = modifier;
+	/* reports under lock, like a key event */
+	schedule_work(&fujitsu->sticky_work);
 }
 
-static void fujitsu_sticky_modifier_timeout(unsigned long keycode)
+static void fujitsu_sticky_work(struct work_struct *work)
 {
-	fujitsu_set_modifier(MODIFIER_NONE);
+	struct fujitsu_tablet *fujitsu =
+		container_of(work, struct fujitsu_tablet, sticky_work);
+	keymap_modifier old;
+
+	mutex_lock(&fujitsu->lock);
+
+	fujitsu->stats.sticky++;
+
+	old = fujitsu->modifier;
+	trace_fujitsu_sticky_timeout(old);
+
+	/* a key event came first */
+	if (!fujitsu->sticky_pending)
+		goto out;
+
+	/* the timer was rearmed while this work was already pending */
+	if (time_before(jiffies, fujitsu->sticky_expires))
+		goto out;
+
+	fujitsu->sticky_pending = 0;
+	fujitsu->modifier = MODIFIER_NONE;
+
+	if (fujitsu_report_modifier(fujitsu, old, MODIFIER_NONE)) {
+		fujitsu->frame_time = ktime_get();
+		fujitsu_sync(fujitsu);
+	}
+out:
+	mutex_unlock(&fujitsu->lock);
 }
 
-static void fujitsu_start_sticky_modifier_timer(unsigned long keycode)
+/* after the sources of key events, before the input device goes away */
+static void fujitsu_sticky_stop(struct fujitsu_tablet *fujitsu)
 {
-	fujitsu.sticky_timer.data = keycode;
-	fujitsu.sticky_timer.function = fujitsu_sticky_modifier_timeout;
-	fujitsu.sticky_timer.expires = jiffies + (1400*HZ)/1000;
-	add_timer(&fujitsu.sticky_timer);
+	del_timer_sync(&fujitsu->sticky_timer);
+	cancel_work_sync(&fujitsu->sticky_work);
 }
 
-static void fujitsu_handle_key(int keycode, int pressed)
+static void fujitsu_handle_key(struct fujitsu_tablet *fujitsu,
+		int keycode, int pressed)
 {
+	keymap_modifier old = fujitsu->modifier;
 	keymap_modifier modifier;
 
-	del_timer(&fujitsu.sticky_timer);
-
-	printk(KERN_DEBUG MODULENAME ": fujitsu_handle_key: keycode=%d pressed=%d",
-			keycode, pressed);
+	/* userspace does the sticky modifiers */
+	if (!sticky) {
+		trace_fujitsu_key(keycode, pressed, MODIFIER_NONE);
+		fujitsu_event(fujitsu, EV_KEY, keycode, pressed);
+		return;
+	}
 
 	modifier = MODIFIER_MAX;
 	while (--modifier > 0) {
@@ -311,92 +1118,494 @@ static void fujitsu_handle_key(int keycode, int pressed)
 			break;
 	}
 
-	switch (modifier) {
-	case MODIFIER_NONE:
-		input_report_key(fujitsu.idev, keycode, pressed);
-		input_sync(fujitsu.idev);
+	if (modifier == MODIFIER_NONE)
+		fujitsu_event(fujitsu, EV_KEY, keycode, pressed);
+
+	/* every key cancels a pending sticky timeout */
+	fujitsu->sticky_pending = 0;
+
+	if (modifier == MODIFIER_NONE) {
+		if ((!pressed) && (!fujitsu->modifier_down))
+			fujitsu->modifier = MODIFIER_NONE;
+	} else if (pressed) {
+		fujitsu->modifier_down++;
+
+		/* unset modifier is another modifier active */
+		fujitsu->modifier = old ? MODIFIER_NONE : modifier;
+	} else {
+		if (fujitsu->modifier_down)
+			fujitsu->modifier_down--;
+
+		/* start sticky timer if no other key pressed
+		 * while modifier key was hold down */
+		if (fujitsu->prev_key == keycode) {
+			fujitsu->sticky_pending = 1;
+			fujitsu->sticky_expires =
+				jiffies + msecs_to_jiffies(1400);
+			mod_timer(&fujitsu->sticky_timer,
+					fujitsu->sticky_expires);
+		}
+	}
+
+	fujitsu->prev_key = (pressed) ? keycode : 0;
+
+	trace_fujitsu_key(keycode, pressed, old);
+
+	fujitsu_report_modifier(fujitsu, old, fujitsu->modifier);
+}
+
+static void fujitsu_irq_entry(struct fujitsu_tablet *fujitsu)
+{
+	ktime_t now = ktime_get();
+
+	if (ktime_to_ns(fujitsu->irq_time))
+		fujitsu_hist_add(fujitsu->stats.interval,
+				ktime_sub(now, fujitsu->irq_time));
+	fujitsu->irq_time = now;
+}
+
+/* keys which are not reported in the current dock and tablet state */
+static unsigned long fujitsu_inhibit_mask(struct fujitsu_tablet *fujitsu)
+{
+	if (ACCESS_ONCE(fujitsu->inhibited))
+		return 0xffff;
+
+	if (fujitsu->dock > 0)
+		return ACCESS_ONCE(fujitsu->inhibit_dock);
+	if (fujitsu->tablet_mode > 0)
+		return ACCESS_ONCE(fujitsu->inhibit_tablet);
+	return ACCESS_ONCE(fujitsu->inhibit_laptop);
+}
+
+static irqreturn_t fujitsu_interrupt(int irq, void *dev_id)
+{
+	struct fujitsu_tablet *fujitsu = dev_id;
+	u8 status;
+
+	fujitsu_irq_entry(fujitsu);
+
+	status = fujitsu_status(fujitsu);
+	trace_fujitsu_irq(irq, status);
+
+	if (unlikely(!(status & 0x01))) {
+		fujitsu->stats.spurious++;
+		return IRQ_NONE;
+	}
+
+	fujitsu_read_event(fujitsu);
+	return IRQ_WAKE_THREAD;
+}
+
+static void fujitsu_report_bit(struct fujitsu_tablet *fujitsu,
+		struct fujitsu_config *config, int bit, int pressed)
+{
+	keymap_modifier modifier = MODIFIER_NONE;
+
+	if (sticky)
+		modifier = fujitsu->modifier;
+
+	if (pressed)
+		fujitsu_event(fujitsu, EV_MSC, MSC_SCAN, bit);
+
+	fujitsu_handle_key(fujitsu, config->keymap[bit][modifier], pressed);
+}
+
+/* a gesture is a press and release of its keycode, the caller syncs */
+static void fujitsu_report_gesture(struct fujitsu_tablet *fujitsu,
+		unsigned int scancode, unsigned int keycode)
+{
+	fujitsu->stats.gestures++;
+
+	fujitsu_event(fujitsu, EV_MSC, MSC_SCAN, scancode);
+	fujitsu_event(fujitsu, EV_KEY, keycode, 1);
+	fujitsu_sync(fujitsu);
+	fujitsu_event(fujitsu, EV_KEY, keycode, 0);
+}
+
+/* reports the held back key, the caller syncs */
+static void fujitsu_gesture_flush(struct fujitsu_tablet *fujitsu,
+		struct fujitsu_config *config, int released)
+{
+	fujitsu->gesture_state = GESTURE_IDLE;
+	fujitsu_report_bit(fujitsu, config, fujitsu->gesture_bit, 1);
+
+	if (released) {
+		fujitsu_sync(fujitsu);
+		fujitsu_report_bit(fujitsu, config, fujitsu->gesture_bit, 0);
+	}
+}
+
+/*
+ * The timeouts are relative to the hard irq of the gesture_start event.
+ * A callback still running would see the new sequence, so it is waited
+ * for before the sequence changes.
+ */
+static void fujitsu_gesture_timer_start(struct fujitsu_tablet *fujitsu,
+		unsigned int msecs)
+{
+	hrtimer_cancel(&fujitsu->gesture_timer);
+	fujitsu->gesture_armed = ++fujitsu->gesture_seq;
+	hrtimer_start(&fujitsu->gesture_timer,
+			ktime_add(fujitsu->gesture_start,
+				ns_to_ktime((u64) msecs * NSEC_PER_MSEC)),
+			HRTIMER_MODE_ABS);
+}
 
-		if ((!pressed) && (!fujitsu.modifier_down))
-			fujitsu_set_modifier(MODIFIER_NONE);
+static void fujitsu_gesture_timer_cancel(struct fujitsu_tablet *fujitsu)
+{
+	hrtimer_cancel(&fujitsu->gesture_timer);
+	fujitsu->gesture_seq++;
+}
 
+static void fujitsu_gesture_done(struct fujitsu_tablet *fujitsu,
+		unsigned long keys, unsigned int scancode, unsigned int keycode)
+{
+	fujitsu->gesture_state = GESTURE_DONE;
+	fujitsu->gesture_done = keys;
+	fujitsu_report_gesture(fujitsu, scancode, keycode);
+}
+
+/*
+ * A key with a gesture keycode is held back until it is clear what the
+ * user did: a chord if another chord key follows within gesture_chord,
+ * a long press if it is held for gesture_long and a double press if it
+ * is pressed again within gesture_double.  Otherwise the plain key is
+ * reported late.  Keys without gestures are never delayed.
+ *
+ * Called with lock held, returns 1 if the key event was taken.
+ */
+static int fujitsu_gesture(struct fujitsu_tablet *fujitsu,
+		struct fujitsu_config *config, int bit, int pressed)
+{
+	struct fujitsu_gestures *g = &config->gestures;
+	int prev = fujitsu->gesture_bit;
+	int lower = min(bit, prev), higher = max(bit, prev);
+
+	switch (fujitsu->gesture_state) {
+	case GESTURE_IDLE:
 		break;
 
-	default:
-		if (pressed) {
-			fujitsu.modifier_down++;
-
-			/* unset modifier is another modifier active */
-			if (fujitsu.modifier)
-				modifier = MODIFIER_NONE;
-			fujitsu_set_modifier(modifier);
-		} else {
-			fujitsu.modifier_down--;
-
-			/* start sticky timer if no other key pressed
-			 * while modifier key was hold down */
-			if (fujitsu.prev_key == keycode)
-				fujitsu_start_sticky_modifier_timer(keycode);
+	case GESTURE_DONE:
+		if (pressed || !(fujitsu->gesture_done & BIT(bit)))
+			return 0;
+
+		fujitsu->gesture_done &= ~BIT(bit);
+		if (!fujitsu->gesture_done)
+			fujitsu->gesture_state = GESTURE_IDLE;
+		return 1;
+
+	case GESTURE_DOWN:
+	case GESTURE_HELD:
+		if (bit == prev) {
+			fujitsu_gesture_timer_cancel(fujitsu);
+
+			if (g->twice[bit]) {
+				fujitsu->gesture_state = GESTURE_UP;
+				fujitsu->gesture_start = fujitsu->frame_time;
+				fujitsu_gesture_timer_start(fujitsu,
+						ACCESS_ONCE(gesture_double));
+			} else {
+				fujitsu_gesture_flush(fujitsu, config, 1);
+			}
+			return 1;
+		}
+
+		/* released a key which was pressed before */
+		if (!pressed)
+			return 0;
+
+		fujitsu_gesture_timer_cancel(fujitsu);
+
+		if (fujitsu->gesture_state == GESTURE_DOWN &&
+		    g->chord[lower][higher]) {
+			fujitsu_gesture_done(fujitsu, BIT(bit) | BIT(prev),
+				SCANCODE_CHORD + lower * KEYMAP_LEN + higher,
+				g->chord[lower][higher]);
+			return 1;
+		}
+
+		fujitsu_gesture_flush(fujitsu, config, 0);
+		break;
+
+	case GESTURE_UP:
+		if (!pressed)
+			return 0;
+
+		fujitsu_gesture_timer_cancel(fujitsu);
+
+		if (bit == prev) {
+			fujitsu_gesture_done(fujitsu, BIT(bit),
+					SCANCODE_TWICE + bit, g->twice[bit]);
+			return 1;
 		}
+
+		fujitsu_gesture_flush(fujitsu, config, 1);
 		break;
 	}
 
-	fujitsu.prev_key = (pressed) ? keycode : 0;
+	if (!pressed || !(g->keys & BIT(bit)))
+		return 0;
+
+	fujitsu->gesture_bit = bit;
+	fujitsu->gesture_start = fujitsu->frame_time;
+
+	if (g->chords & BIT(bit)) {
+		fujitsu->gesture_state = GESTURE_DOWN;
+		fujitsu_gesture_timer_start(fujitsu, ACCESS_ONCE(gesture_chord));
+	} else {
+		fujitsu->gesture_state = GESTURE_HELD;
+		if (g->hold[bit])
+			fujitsu_gesture_timer_start(fujitsu,
+					ACCESS_ONCE(gesture_long));
+	}
+
+	return 1;
 }
 
-static irqreturn_t fujitsu_interrupt(int irq, void *dev_id)
+static enum hrtimer_restart fujitsu_gesture_timeout(struct hrtimer *timer)
+{
+	struct fujitsu_tablet *fujitsu =
+		container_of(timer, struct fujitsu_tablet, gesture_timer);
+
+	fujitsu->gesture_fired = ACCESS_ONCE(fujitsu->gesture_armed);
+	schedule_work(&fujitsu->gesture_work);
+	return HRTIMER_NORESTART;
+}
+
+static void fujitsu_gesture_work(struct work_struct *work)
+{
+	struct fujitsu_tablet *fujitsu =
+		container_of(work, struct fujitsu_tablet, gesture_work);
+	struct fujitsu_config *config;
+	struct fujitsu_gestures *g;
+	int bit;
+
+	mutex_lock(&fujitsu->lock);
+
+	/* a key event came first */
+	if (fujitsu->gesture_fired != fujitsu->gesture_seq)
+		goto out;
+
+	bit = fujitsu->gesture_bit;
+	fujitsu->frame_time = ktime_get();
+
+	rcu_read_lock();
+	config = rcu_dereference(fujitsu->config);
+	g = &config->gestures;
+
+	switch (fujitsu->gesture_state) {
+	case GESTURE_DOWN:
+		if (g->hold[bit] || g->twice[bit]) {
+			fujitsu->gesture_state = GESTURE_HELD;
+			if (g->hold[bit])
+				fujitsu_gesture_timer_start(fujitsu,
+						ACCESS_ONCE(gesture_long));
+			break;
+		}
+
+		fujitsu_gesture_flush(fujitsu, config, 0);
+		fujitsu_sync(fujitsu);
+		break;
+
+	case GESTURE_HELD:
+		if (g->hold[bit])
+			fujitsu_gesture_done(fujitsu, BIT(bit),
+					SCANCODE_HOLD + bit, g->hold[bit]);
+		else
+			fujitsu_gesture_flush(fujitsu, config, 0);
+		fujitsu_sync(fujitsu);
+		break;
+
+	case GESTURE_UP:
+		fujitsu_gesture_flush(fujitsu, config, 1);
+		fujitsu_sync(fujitsu);
+		break;
+
+	default:
+		break;
+	}
+
+	rcu_read_unlock();
+out:
+	mutex_unlock(&fujitsu->lock);
+}
+
+static void fujitsu_gesture_stop(struct fujitsu_tablet *fujitsu)
+{
+	/* the work restarts the timer */
+	hrtimer_cancel(&fujitsu->gesture_timer);
+	cancel_work_sync(&fujitsu->gesture_work);
+	hrtimer_cancel(&fujitsu->gesture_timer);
+}
+
+/* reports the register values of one interrupt as a single frame */
+static void fujitsu_handle_event(struct fujitsu_tablet *fujitsu,
+		u8 state, unsigned long keymask)
 {
-	unsigned long keymask, changed;
-	unsigned int keycode;
+	struct fujitsu_config *config;
+	unsigned long changed, raw_changed;
 	int pressed;
+	int sync;
 	int i;
 
-	if (unlikely(!(fujitsu_status() & 0x01)))
-		return IRQ_NONE;
+	sync = fujitsu_send_state(fujitsu, state);
 
-	fujitsu_send_state();
+	raw_changed = keymask ^ fujitsu->raw_keymask;
+	fujitsu->raw_keymask = keymask;
 
-	keymask  = fujitsu_read_register(0xde);
-	keymask |= fujitsu_read_register(0xdf) << 8;
-	keymask ^= 0xffff;
+	/* inhibited keys are dropped, a key pressed before is released */
+	keymask &= ~(fujitsu_inhibit_mask(fujitsu) & ~fujitsu->prev_keymask);
 
-	changed = keymask ^ fujitsu.prev_keymask;
+	changed = keymask ^ fujitsu->prev_keymask;
+	trace_fujitsu_keymask(keymask, changed);
 	if (changed) {
-		fujitsu.prev_keymask = keymask;
+		fujitsu->prev_keymask = keymask;
 
-		for_each_set_bit(i, &changed, KEYMAP_LEN) {
-			keycode = fujitsu.config.keymap[i][fujitsu.modifier];
-			pressed = keymask & changed & BIT(i);
+		rcu_read_lock();
+		config = rcu_dereference(fujitsu->config);
 
-			if (pressed)
-				input_event(fujitsu.idev, EV_MSC, MSC_SCAN, i);
+		for_each_set_bit(i, &changed, KEYMAP_LEN) {
+			pressed = !!(keymask & BIT(i));
 
-			fujitsu_handle_key(keycode, pressed);
+			if (!fujitsu_gesture(fujitsu, config, i, pressed))
+				fujitsu_report_bit(fujitsu, config, i, pressed);
 		}
+
+		rcu_read_unlock();
+		fujitsu->stats.key_frames++;
+	} else if (sync) {
+		fujitsu->stats.switch_only++;
+	} else if (raw_changed) {
+		fujitsu->stats.inhibited++;
+		return;
+	} else {
+		fujitsu->stats.unchanged++;
+		return;
 	}
 
-	fujitsu_ack();
+	fujitsu_sync(fujitsu);
+}
+
+static irqreturn_t fujitsu_interrupt_thread(int irq, void *dev_id)
+{
+	struct fujitsu_tablet *fujitsu = dev_id;
+	unsigned long flags, keymask;
+	u8 state;
+
+	mutex_lock(&fujitsu->lock);
+	fujitsu->stats.handled++;
+	fujitsu->frame_time = fujitsu->irq_time;
+
+	spin_lock_irqsave(&fujitsu->io_lock, flags);
+	state = fujitsu->event_state;
+	keymask = fujitsu->event_keymask;
+	spin_unlock_irqrestore(&fujitsu->io_lock, flags);
+
+	fujitsu_handle_event(fujitsu, state, keymask);
+
+	/* the hard irq of a later interrupt may have moved irq_time */
+	fujitsu_hist_add(fujitsu->stats.duration,
+			ktime_sub(ktime_get(), fujitsu->frame_time));
+	mutex_unlock(&fujitsu->lock);
+
+	fujitsu_notify_state(fujitsu);
 	return IRQ_HANDLED;
 }
 
+/* poll fast while keys are held down or were used recently */
+static ktime_t fujitsu_poll_interval(struct fujitsu_tablet *fujitsu)
+{
+	unsigned int interval = ACCESS_ONCE(poll_idle);
+
+	if (ACCESS_ONCE(fujitsu->prev_keymask) ||
+	    time_before(jiffies, ACCESS_ONCE(fujitsu->poll_event) +
+			msecs_to_jiffies(ACCESS_ONCE(poll_active))))
+		interval = ACCESS_ONCE(poll_fast);
+
+	return ns_to_ktime((u64) max(interval, 1U) * NSEC_PER_MSEC);
+}
+
+/*
+ * The poll timer does the same as the hard irq handler, the work
+ * the same as the irq thread.  The timer is restarted after the work.
+ */
+static enum hrtimer_restart fujitsu_poll(struct hrtimer *timer)
+{
+	struct fujitsu_tablet *fujitsu =
+		container_of(timer, struct fujitsu_tablet, poll_timer);
+
+	fujitsu->stats.polls++;
+	fujitsu->poll_window_count++;
+	if (time_after_eq(jiffies, fujitsu->poll_window + HZ)) {
+		fujitsu->stats.poll_rate = fujitsu->poll_window_count;
+		fujitsu->poll_window_count = 0;
+		fujitsu->poll_window = jiffies;
+	}
+
+	if (fujitsu_status(fujitsu) & 0x01) {
+		fujitsu_irq_entry(fujitsu);
+		fujitsu_read_event(fujitsu);
+		schedule_work(&fujitsu->poll_work);
+		return HRTIMER_NORESTART;
+	}
+
+	if (ACCESS_ONCE(fujitsu->poll_stop))
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, fujitsu_poll_interval(fujitsu));
+	return HRTIMER_RESTART;
+}
+
+static void fujitsu_poll_work(struct work_struct *work)
+{
+	struct fujitsu_tablet *fujitsu =
+		container_of(work, struct fujitsu_tablet, poll_work);
+
+	fujitsu_interrupt_thread(0, fujitsu);
+	fujitsu->poll_event = jiffies;
+
+	if (!ACCESS_ONCE(fujitsu->poll_stop))
+		hrtimer_start(&fujitsu->poll_timer,
+				fujitsu_poll_interval(fujitsu),
+				HRTIMER_MODE_REL);
+}
+
+static void fujitsu_poll_start(struct fujitsu_tablet *fujitsu)
+{
+	fujitsu->poll_window = jiffies;
+	fujitsu->poll_stop = 0;
+	hrtimer_start(&fujitsu->poll_timer, fujitsu_poll_interval(fujitsu),
+			HRTIMER_MODE_REL);
+}
+
+static void fujitsu_poll_stop(struct fujitsu_tablet *fujitsu)
+{
+	fujitsu->poll_stop = 1;
+	/* a work that saw poll_stop unset restarts the timer */
+	hrtimer_cancel(&fujitsu->poll_timer);
+	cancel_work_sync(&fujitsu->poll_work);
+	hrtimer_cancel(&fujitsu->poll_timer);
+}
+
 static void __devinit fujitsu_dmi_common(const struct dmi_system_id *dmi)
 {
 	printk(KERN_INFO MODULENAME ": %s\n", dmi->ident);
-	memcpy(fujitsu.config.keymap, dmi->driver_data,
-			sizeof(fujitsu.config.keymap));
+	memcpy(fujitsu_config.keymap, dmi->driver_data,
+			sizeof(fujitsu_config.keymap));
 }
 
 static int __devinit fujitsu_dmi_tseries(const struct dmi_system_id *dmi)
 {
 	fujitsu_dmi_common(dmi);
-	fujitsu.config.quirks |= INVERT_TABLET_MODE_BIT;
+	fujitsu_config.quirks |= INVERT_TABLET_MODE_BIT;
 	return 1;
 }
 
 static int __devinit fujitsu_dmi_stylistic(const struct dmi_system_id *dmi)
 {
 	fujitsu_dmi_common(dmi);
-	fujitsu.config.quirks |= FORCE_TABLET_MODE_IF_UNDOCK;
-	fujitsu.config.quirks |= INVERT_TABLET_MODE_BIT;
+	fujitsu_config.quirks |= FORCE_TABLET_MODE_IF_UNDOCK;
+	fujitsu_config.quirks |= INVERT_TABLET_MODE_BIT;
 	return 1;
 }
 
@@ -467,21 +1676,202 @@ static struct dmi_system_id dmi_ids[] __initconst = {
 	{ NULL }
 };
 
+/*
+ * "<keymask> <dock> <tablet>" written to the inject file is handled like
+ * an interrupt: keymask has a bit set for every pressed key, dock and
+ * tablet are the raw state bits before the model quirks are applied.
+ */
+static ssize_t fujitsu_inject_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct fujitsu_tablet *fujitsu = file->private_data;
+	char buf[32];
+	unsigned int keymask, dock, tablet;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%x %u %u", &keymask, &dock, &tablet) != 3)
+		return -EINVAL;
+
+	mutex_lock(&fujitsu->lock);
+	fujitsu->stats.handled++;
+	fujitsu_irq_entry(fujitsu);
+	fujitsu->frame_time = fujitsu->irq_time;
+	fujitsu_handle_event(fujitsu, (dock ? 0x02 : 0) | (tablet ? 0x01 : 0),
+			keymask & 0xffff);
+	mutex_unlock(&fujitsu->lock);
+
+	return count;
+}
+
+static int fujitsu_inject_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations fujitsu_inject_fops = {
+	.owner  = THIS_MODULE,
+	.open   = fujitsu_inject_open,
+	.write  = fujitsu_inject_write,
+	.llseek = no_llseek,
+};
+
+static int fujitsu_hist_show(struct seq_file *m, void *v)
+{
+	u32 *hist = m->private;
+	int i;
+
+	seq_printf(m, "%10s %10s\n", "usecs", "count");
+	seq_printf(m, "%10s %10u\n", "0", hist[0]);
+	for (i = 1; i < HIST_LEN; i++)
+		seq_printf(m, "%10lu %10u\n", 1UL << (i - 1), hist[i]);
+
+	return 0;
+}
+
+static int fujitsu_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, fujitsu_hist_show, inode->i_private);
+}
+
+static const struct file_operations fujitsu_hist_fops = {
+	.owner   = THIS_MODULE,
+	.open    = fujitsu_hist_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+static void __devinit fujitsu_debugfs_init(struct fujitsu_tablet *fujitsu,
+		const char *name)
+{
+	if (!fujitsu_debugfs)
+		return;
+
+	fujitsu->debugfs = debugfs_create_dir(name, fujitsu_debugfs);
+	if (IS_ERR_OR_NULL(fujitsu->debugfs)) {
+		fujitsu->debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_u32("handled", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.handled);
+	debugfs_create_u32("unchanged", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.unchanged);
+	debugfs_create_u32("switch_only", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.switch_only);
+	debugfs_create_u32("key_frames", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.key_frames);
+	debugfs_create_u32("sticky", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.sticky);
+	debugfs_create_u32("gestures", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.gestures);
+	debugfs_create_u32("frames", S_IRUGO, fujitsu->debugfs,
+			&fujitsu->stats.frames);
+
+	/* virtual devices have no i/o ports */
+	if (fujitsu->io_base) {
+		debugfs_create_u32("spurious", S_IRUGO, fujitsu->debugfs,
+				&fujitsu->stats.spurious);
+		debugfs_create_u32("inhibited", S_IRUGO, fujitsu->debugfs,
+				&fujitsu->stats.inhibited);
+		debugfs_create_u32("polls", S_IRUGO, fujitsu->debugfs,
+				&fujitsu->stats.polls);
+		debugfs_create_u32("poll_rate", S_IRUGO, fujitsu->debugfs,
+				&fujitsu->stats.poll_rate);
+		debugfs_create_u32("ready_ms", S_IRUGO, fujitsu->debugfs,
+				&fujitsu->stats.ready_ms);
+		debugfs_create_file("duration", S_IRUGO, fujitsu->debugfs,
+				fujitsu->stats.duration, &fujitsu_hist_fops);
+		debugfs_create_file("interval", S_IRUGO, fujitsu->debugfs,
+				fujitsu->stats.interval, &fujitsu_hist_fops);
+	} else
+		debugfs_create_file("inject", S_IWUSR, fujitsu->debugfs,
+				fujitsu, &fujitsu_inject_fops);
+}
+
+static void fujitsu_debugfs_remove(struct fujitsu_tablet *fujitsu)
+{
+	debugfs_remove_recursive(fujitsu->debugfs);
+	fujitsu->debugfs = NULL;
+}
+
+/* dev is the acpi device, NULL for virtual devices */
+static struct fujitsu_tablet *fujitsu_alloc(struct device *dev)
+{
+	struct fujitsu_tablet *fujitsu;
+	struct fujitsu_config *config;
+
+	if (dev)
+		fujitsu = devm_kzalloc(dev, sizeof(*fujitsu), GFP_KERNEL);
+	else
+		fujitsu = kzalloc(sizeof(*fujitsu), GFP_KERNEL);
+	if (!fujitsu)
+		return NULL;
+
+	/* replaced at runtime, so not devm-managed */
+	config = kmemdup(&fujitsu_config, sizeof(fujitsu_config), GFP_KERNEL);
+	if (!config) {
+		if (!dev)
+			kfree(fujitsu);
+		return NULL;
+	}
+	RCU_INIT_POINTER(fujitsu->config, config);
+	fujitsu->dev = dev;
+	fujitsu->sysfs_dock = -1;
+	fujitsu->sysfs_tablet_mode = -1;
+	fujitsu->inhibit_laptop = inhibit_laptop & 0xffff;
+	fujitsu->inhibit_tablet = inhibit_tablet & 0xffff;
+	fujitsu->inhibit_dock = inhibit_dock & 0xffff;
+
+	setup_timer(&fujitsu->sticky_timer, fujitsu_sticky_modifier_timeout,
+			(unsigned long) fujitsu);
+	INIT_WORK(&fujitsu->sticky_work, fujitsu_sticky_work);
+	INIT_DELAYED_WORK(&fujitsu->reset_work, fujitsu_reset_work);
+	hrtimer_init(&fujitsu->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	fujitsu->poll_timer.function = fujitsu_poll;
+	INIT_WORK(&fujitsu->poll_work, fujitsu_poll_work);
+	hrtimer_init(&fujitsu->gesture_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	fujitsu->gesture_timer.function = fujitsu_gesture_timeout;
+	INIT_WORK(&fujitsu->gesture_work, fujitsu_gesture_work);
+	mutex_init(&fujitsu->lock);
+	spin_lock_init(&fujitsu->io_lock);
+
+	return fujitsu;
+}
+
+static void fujitsu_free(struct fujitsu_tablet *fujitsu)
+{
+	kfree(rcu_dereference_protected(fujitsu->config, 1));
+
+	/* the one of an acpi device is freed by devres after remove */
+	if (!fujitsu->dev)
+		kfree(fujitsu);
+}
+
 static acpi_status __devinit
 fujitsu_walk_resources(struct acpi_resource *res, void *data)
 {
+	struct fujitsu_tablet *fujitsu = data;
+
 	switch (res->type) {
 	case ACPI_RESOURCE_TYPE_IRQ:
-		fujitsu.irq = res->data.irq.interrupts[0];
+		fujitsu->irq = res->data.irq.interrupts[0];
 		return AE_OK;
 
 	case ACPI_RESOURCE_TYPE_IO:
-		fujitsu.io_base = res->data.io.minimum;
-		fujitsu.io_length = res->data.io.address_length;
+		fujitsu->io_base = res->data.io.minimum;
+		fujitsu->io_length = res->data.io.address_length;
 		return AE_OK;
 
 	case ACPI_RESOURCE_TYPE_END_TAG:
-		if (fujitsu.irq && fujitsu.io_base)
+		/* without an interrupt the controller is polled */
+		if (fujitsu->io_base)
 			return AE_OK;
 		else
 			return AE_NOT_FOUND;
@@ -493,57 +1883,99 @@ fujitsu_walk_resources(struct acpi_resource *res, void *data)
 
 static int __devinit acpi_fujitsu_add(struct acpi_device *adev)
 {
+	struct fujitsu_tablet *fujitsu;
 	acpi_status status;
 	int error;
 
 	if (!adev)
 		return -EINVAL;
 
+	fujitsu = fujitsu_alloc(&adev->dev);
+	if (!fujitsu)
+		return -ENOMEM;
+
 	status = acpi_walk_resources(adev->handle, METHOD_NAME__CRS,
-			fujitsu_walk_resources, NULL);
-	if (ACPI_FAILURE(status) || !fujitsu.irq || !fujitsu.io_base)
-		return -ENODEV;
+			fujitsu_walk_resources, fujitsu);
+	if (ACPI_FAILURE(status) || !fujitsu->io_base) {
+		error = -ENODEV;
+		goto err_free;
+	}
 
 	sprintf(acpi_device_name(adev), "Fujitsu %s", acpi_device_hid(adev));
 	sprintf(acpi_device_class(adev), "%s", ACPI_FUJITSU_CLASS);
 
-	snprintf(fujitsu.phys, sizeof(fujitsu.phys),
+	snprintf(fujitsu->phys, sizeof(fujitsu->phys),
 			"%s/input0", acpi_device_hid(adev));
 
-	error = input_fujitsu_setup(&adev->dev,
-		acpi_device_name(adev), fujitsu.phys);
+	error = input_fujitsu_setup(fujitsu, &adev->dev,
+		acpi_device_name(adev), fujitsu->phys);
 	if (error)
-		return error;
+		goto err_free;
 
-	if (!request_region(fujitsu.io_base, fujitsu.io_length, MODULENAME)) {
-		input_fujitsu_remove();
-		return -EBUSY;
+	if (!devm_request_region(&adev->dev, fujitsu->io_base,
+				fujitsu->io_length, MODULENAME)) {
+		error = -EBUSY;
+		goto err_input;
 	}
 
-	fujitsu_reset();
-
-	error = request_irq(fujitsu.irq, fujitsu_interrupt,
-			IRQF_SHARED, MODULENAME, fujitsu_interrupt);
-	if (error) {
-		release_region(fujitsu.io_base, fujitsu.io_length);
-		input_fujitsu_remove();
-		return error;
+	/* read by the attributes */
+	adev->driver_data = fujitsu;
+	error = sysfs_create_group(&adev->dev.kobj, &fujitsu_attr_group);
+	if (error)
+		goto err_input;
+
+	fujitsu_reset(fujitsu);
+
+	if (fujitsu->irq) {
+		error = devm_request_threaded_irq(&adev->dev, fujitsu->irq,
+				fujitsu_interrupt, fujitsu_interrupt_thread,
+				IRQF_SHARED, MODULENAME, fujitsu);
+		if (error)
+			goto err_reset;
+	} else {
+		printk(KERN_INFO MODULENAME ": %s has no interrupt, polling\n",
+				dev_name(&adev->dev));
+		fujitsu_poll_start(fujitsu);
 	}
 
+	fujitsu_debugfs_init(fujitsu, dev_name(&adev->dev));
 	return 0;
+
+err_reset:
+	cancel_delayed_work_sync(&fujitsu->reset_work);
+	fujitsu_sticky_stop(fujitsu);
+	sysfs_remove_group(&adev->dev.kobj, &fujitsu_attr_group);
+err_input:
+	input_fujitsu_remove(fujitsu);
+err_free:
+	fujitsu_free(fujitsu);
+	return error;
 }
 
 static int __devexit acpi_fujitsu_remove(struct acpi_device *adev, int type)
 {
-	free_irq(fujitsu.irq, fujitsu_interrupt);
-	release_region(fujitsu.io_base, fujitsu.io_length);
-	input_fujitsu_remove();
+	struct fujitsu_tablet *fujitsu = acpi_driver_data(adev);
+
+	fujitsu_debugfs_remove(fujitsu);
+
+	/* devres would free the irq after the timers it arms are gone,
+	 * the region and the memory are left to it */
+	if (fujitsu->irq)
+		devm_free_irq(&adev->dev, fujitsu->irq, fujitsu);
+	else
+		fujitsu_poll_stop(fujitsu);
+	fujitsu_gesture_stop(fujitsu);
+	cancel_delayed_work_sync(&fujitsu->reset_work);
+	fujitsu_sticky_stop(fujitsu);
+	sysfs_remove_group(&adev->dev.kobj, &fujitsu_attr_group);
+	input_fujitsu_remove(fujitsu);
+	fujitsu_free(fujitsu);
 	return 0;
 }
 
 static int acpi_fujitsu_resume(struct acpi_device *adev)
 {
-	fujitsu_reset();
+	fujitsu_reset(acpi_driver_data(adev));
 	return 0;
 }
 
@@ -558,27 +1990,136 @@ static struct acpi_driver acpi_fujitsu_driver = {
 	}
 };
 
-static int __init fujitsu_module_init(void)
+static int __init fujitsu_virtual_add(int id)
 {
+	struct fujitsu_tablet *fujitsu;
+	char name[16];
 	int error;
 
-	dmi_check_system(dmi_ids);
+	fujitsu = fujitsu_alloc(NULL);
+	if (!fujitsu)
+		return -ENOMEM;
 
-	init_timer(&fujitsu.sticky_timer);
+	snprintf(name, sizeof(name), "virtual%d", id);
+	snprintf(fujitsu->phys, sizeof(fujitsu->phys), "%s/input0", name);
 
-	error = acpi_bus_register_driver(&acpi_fujitsu_driver);
+	error = input_fujitsu_setup(fujitsu, NULL, "Fujitsu tablet buttons",
+			fujitsu->phys);
 	if (error) {
-		del_timer_sync(&fujitsu.sticky_timer);
+		fujitsu_free(fujitsu);
 		return error;
 	}
 
+	/* report the initial (undocked) switch states */
+	fujitsu->frame_time = ktime_get();
+	fujitsu->dock = -1;
+	fujitsu->tablet_mode = -1;
+	if (fujitsu_send_state(fujitsu, 0))
+		fujitsu_sync(fujitsu);
+
+	fujitsu_debugfs_init(fujitsu, name);
+	list_add_tail(&fujitsu->list, &fujitsu_virtual_devices);
 	return 0;
 }
 
-static void __exit fujitsu_module_exit(void)
+static void fujitsu_virtual_remove_all(void)
+{
+	struct fujitsu_tablet *fujitsu, *next;
+
+	list_for_each_entry_safe(fujitsu, next, &fujitsu_virtual_devices, list) {
+		list_del(&fujitsu->list);
+		fujitsu_debugfs_remove(fujitsu);
+		fujitsu_gesture_stop(fujitsu);
+		fujitsu_sticky_stop(fujitsu);
+		input_fujitsu_remove(fujitsu);
+		fujitsu_free(fujitsu);
+	}
+}
+
+#ifndef MODULE
+static int fujitsu_registered;
+
+/*
+ * Built in, the acpi bus is probed from an async function, so the probe
+ * doesn't hold up the later initcalls during boot.  With initcall_debug
+ * the initcall of the module only covers the dmi match and debugfs, the
+ * probe gets its own "calling"/"returned" pair for
+ * fujitsu_register_async.  A module gains nothing from this, its
+ * init_module waits for all async functions before it returns.
+ */
+static void fujitsu_register_async(void *data, async_cookie_t cookie)
+{
+	int error;
+
+	error = acpi_bus_register_driver(&acpi_fujitsu_driver);
+	if (error)
+		printk(KERN_ERR MODULENAME ": can't register driver (%d)\n",
+				error);
+	else
+		fujitsu_registered = 1;
+}
+
+static int fujitsu_register(void)
+{
+	async_schedule(fujitsu_register_async, NULL);
+	return 0;
+}
+
+static void fujitsu_unregister(void)
+{
+	async_synchronize_full();
+	if (fujitsu_registered)
+		acpi_bus_unregister_driver(&acpi_fujitsu_driver);
+	fujitsu_registered = 0;
+}
+#else
+static int fujitsu_register(void)
+{
+	return acpi_bus_register_driver(&acpi_fujitsu_driver);
+}
+
+static void fujitsu_unregister(void)
 {
 	acpi_bus_unregister_driver(&acpi_fujitsu_driver);
-	del_timer_sync(&fujitsu.sticky_timer);
+}
+#endif
+
+static int __init fujitsu_module_init(void)
+{
+	int error;
+	int i;
+
+	dmi_check_system(dmi_ids);
+
+	fujitsu_debugfs = debugfs_create_dir(MODULENAME, NULL);
+	if (IS_ERR_OR_NULL(fujitsu_debugfs))
+		fujitsu_debugfs = NULL;
+
+	error = fujitsu_register();
+	if (error)
+		goto err_debugfs;
+
+	for (i = 0; i < inject; i++) {
+		error = fujitsu_virtual_add(i);
+		if (error)
+			goto err_virtual;
+	}
+
+	return 0;
+
+err_virtual:
+	fujitsu_virtual_remove_all();
+	fujitsu_unregister();
+err_debugfs:
+	debugfs_remove_recursive(fujitsu_debugfs);
+	return error;
+}
+
+static void __exit fujitsu_module_exit(void)
+{
+	fujitsu_virtual_remove_all();
+	fujitsu_unregister();
+	debugfs_remove_recursive(fujitsu_debugfs);
 }
 
 module_init(fujitsu_module_init);
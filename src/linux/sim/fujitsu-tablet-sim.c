@@ -0,0 +1,1750 @@
+/*
+ * Copyright (C) 2012 Robert Gerlach <khnz@gmx.de>
+ *
+ * You can redistribute and/or modify this program under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Userspace simulation of fujitsu-tablet.c
+ *
+ * The driver is compiled against a mocked port i/o, timer and input
+ * layer (see fujitsu-tablet-sim.h). Register values are replayed from a
+ * script and the emitted input events are checked against the script:
+ *
+ *   model LifeBook T4220       DMI product name (before probe)
+ *   noirq                      no interrupt in _CRS (before probe)
+ *   probe                      load module and add the acpi device
+ *   state 01                   set register 0xdd (dock/tablet state)
+ *   keys 0010                  set pressed keys (registers 0xde/0xdf)
+ *   reg de ef                  set any register
+ *   irq                        raise an interrupt
+ *   spurious                   raise an interrupt of another device
+ *   busy 300                   controller is busy for the next 300 ms
+ *   resume                     resume the acpi device
+ *   sleep 1500                 advance time (fires timers)
+ *   stall 1                    advance time without firing timers, a due
+ *                              hrtimer is as good as running on another
+ *                              cpu until the next sleep
+ *   device virtual0/input0     only check events of this device (by phys)
+ *   expect EV_KEY KEY_FN 1     next emitted event has to match (* matches
+ *                              any value)
+ *   timestamps on              also check MSC_TIMESTAMP events, which are
+ *                              skipped by default
+ *   none                       no emitted events left
+ *   flush                      drop all emitted events
+ *   stats                      print debugfs counters
+ *   cat <path>                 print a debugfs file
+ *   store inhibited 1          write a sysfs attribute of the selected
+ *                              input device (or of the acpi device)
+ *   show inhibited 1           sysfs attribute has to read as the text
+ *   uevent notify dock         next sysfs_notify() or change uevent has to
+ *                              match ("change DOCK=1 TABLET_MODE=0"),
+ *                              without text none may be left
+ *   check <path> <value>       debugfs counter has to match
+ *   param inject 1             set a module parameter (read-only ones
+ *                              only before probe)
+ *   write <path> <text>        write to a debugfs file, e.g.
+ *                              fujitsu-tablet/virtual0/inject 0010 0 1
+ *   setkeycode 17 KEY_HOME     EVIOCSKEYCODE on the selected device
+ *   getkeycode 17 KEY_HOME     EVIOCGKEYCODE has to return the keycode
+ *   keymap 17 KEY_HOME         change one entry through the sysfs keymap
+ *   quirks 1                   change the quirks through the sysfs keymap
+ *   remove                     remove device and unload module
+ *
+ * With -b <count> the driver is probed and <count> synthetic interrupts
+ * are raised to measure the throughput of the interrupt path.
+ */
+
+#include <stdarg.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "../fujitsu-tablet.c"
+
+#define SIM_IRQ     5
+#define SIM_IO_BASE 0xfd60
+#define SIM_IO_LEN  8
+
+/*
+ * controller model
+ *
+ *   base + 0  register index (write)
+ *   base + 2  interrupt ack (read)
+ *   base + 4  register data (read)
+ *   base + 6  status: 0x01 interrupt pending, 0x02 busy
+ */
+
+static struct {
+	u8 index;
+	u8 status;
+	u8 regs[256];
+	int regions;
+	unsigned long ready;	/* end of the busy time */
+} hw;
+
+static struct {
+	const char *dmi[DMI_STRING_MAX];
+	int verbose;
+	int record;
+	int probed;
+	int noirq;
+	int stalled;
+
+	struct acpi_driver *driver;
+	struct acpi_device adev;
+
+	irq_handler_t handler;
+	irq_handler_t thread_fn;
+	void *dev_id;
+
+	struct timer_list *timers[16];
+
+	struct input_dev *idevs[8];
+
+	struct {
+		struct kobject *kobj;
+		const struct bin_attribute *attr;
+	} sysfs[8];
+
+	struct {
+		struct device *dev;
+		const struct device_attribute *attr;
+	} attrs[16];
+
+	struct dentry {
+		char path[64];
+		u32 *value;
+		const struct file_operations *fops;
+		void *data;
+		int used;
+	} debugfs[64];
+
+	struct {
+		const char *name;
+		const char *type;
+		void *value;
+		int writable;
+		u64 def;
+	} params[16];
+	int n_params;
+
+	struct sim_event {
+		char phys[24];
+		unsigned int type, code;
+		int value;
+		int consumed;
+	} *events;
+	unsigned int n_events, max_events, next_event;
+	char **uevents;
+	unsigned int n_uevents, next_uevent;
+	char *device;
+	int timestamps;
+
+	unsigned long irqs, irqs_none;
+	unsigned long n_passed, n_frames;
+} sim = {
+	.dmi = {
+		[DMI_SYS_VENDOR]   = "FUJITSU",
+		[DMI_PRODUCT_NAME] = "LifeBook T4220",
+	},
+	.record = 1,
+};
+
+unsigned long jiffies;
+
+
+ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int n = 0;
+
+	if (sim.verbose) {
+		if (fmt[0] == '<' && fmt[1] && fmt[2] == '>')
+			fmt += 3;
+		va_start(ap, fmt);
+		n = vfprintf(stderr, fmt, ap);
+		va_end(ap);
+	}
+
+	return n;
+}
+
+u8 inb(unsigned long port)
+{
+	switch (port - SIM_IO_BASE) {
+	case 2:
+		hw.status &= ~0x01;
+		return 0;
+	case 4:
+		return hw.regs[hw.index];
+	case 6:
+		if (!time_before(jiffies, hw.ready))
+			hw.status &= ~0x02;
+		return hw.status;
+	default:
+		return 0xff;
+	}
+}
+
+void outb(u8 value, unsigned long port)
+{
+	if (port - SIM_IO_BASE == 0)
+		hw.index = value;
+}
+
+struct resource *request_region(unsigned long start, unsigned long n,
+		const char *name)
+{
+	static struct resource res;
+
+	if (hw.regions)
+		return NULL;
+
+	hw.regions++;
+	res.start = start;
+	return &res;
+}
+
+void release_region(unsigned long start, unsigned long n)
+{
+	hw.regions--;
+}
+
+
+struct sim_devres {
+	sim_devres_release_t release;
+	void *data;
+	unsigned long start, n;
+	struct sim_devres *next;
+};
+
+void sim_devres_add(struct device *dev, sim_devres_release_t release,
+		void *data)
+{
+	struct sim_devres *dr = calloc(1, sizeof(*dr));
+
+	if (!dr)
+		exit(2);
+
+	dr->release = release;
+	dr->data = data;
+	dr->next = dev->devres;
+	dev->devres = dr;
+}
+
+/* removes a resource without releasing it */
+int sim_devres_destroy(struct device *dev, sim_devres_release_t release,
+		void *data)
+{
+	struct sim_devres **p, *dr;
+
+	for (p = &dev->devres; *p; p = &(*p)->next) {
+		dr = *p;
+		if (dr->release == release && dr->data == data) {
+			*p = dr->next;
+			free(dr);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void sim_devres_release_all(struct device *dev)
+{
+	struct sim_devres *dr;
+
+	while ((dr = dev->devres)) {
+		dev->devres = dr->next;
+		dr->release(dev, dr->data);
+		free(dr);
+	}
+}
+
+static void sim_devm_kfree(struct device *dev, void *data)
+{
+	free(data);
+}
+
+void *devm_kzalloc(struct device *dev, size_t size, int flags)
+{
+	void *ptr = calloc(1, size);
+
+	if (ptr)
+		sim_devres_add(dev, sim_devm_kfree, ptr);
+	return ptr;
+}
+
+static void sim_devm_release_region(struct device *dev, void *data)
+{
+	release_region((unsigned long) data, 0);
+}
+
+struct resource *devm_request_region(struct device *dev,
+		unsigned long start, unsigned long n, const char *name)
+{
+	struct resource *res = request_region(start, n, name);
+
+	if (res)
+		sim_devres_add(dev, sim_devm_release_region,
+				(void *) start);
+	return res;
+}
+
+
+/* until none is due, a timer may schedule work that runs right away */
+static void sim_run_timers(void)
+{
+	struct timer_list *timer;
+	int i, ran;
+
+	do {
+		ran = 0;
+		for (i = 0; i < ARRAY_SIZE(sim.timers); i++) {
+			timer = sim.timers[i];
+			if (timer && timer->pending &&
+			    (long)(jiffies - timer->expires) >= 0) {
+				sim.timers[i] = NULL;
+				timer->pending = 0;
+				timer->function(timer->data);
+				ran = 1;
+			}
+		}
+	} while (ran);
+}
+
+static void sim_sleep(unsigned long msecs)
+{
+	sim.stalled = 0;
+	while (msecs--) {
+		jiffies++;
+		sim_run_timers();
+	}
+}
+
+void init_timer(struct timer_list *timer)
+{
+	timer->pending = 0;
+}
+
+void add_timer(struct timer_list *timer)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.timers); i++) {
+		if (!sim.timers[i]) {
+			sim.timers[i] = timer;
+			timer->pending = 1;
+			return;
+		}
+	}
+
+	fprintf(stderr, "sim: too many timers\n");
+	exit(2);
+}
+
+int del_timer(struct timer_list *timer)
+{
+	int i;
+
+	if (!timer->pending)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(sim.timers); i++)
+		if (sim.timers[i] == timer)
+			sim.timers[i] = NULL;
+
+	timer->pending = 0;
+	return 1;
+}
+
+int mod_timer(struct timer_list *timer, unsigned long expires)
+{
+	int pending = del_timer(timer);
+
+	timer->expires = expires;
+	add_timer(timer);
+	return pending;
+}
+
+int del_timer_sync(struct timer_list *timer)
+{
+	return del_timer(timer);
+}
+
+
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+		irq_handler_t thread_fn, unsigned long flags,
+		const char *name, void *dev_id)
+{
+	if (irq != SIM_IRQ || sim.handler)
+		return -EBUSY;
+
+	sim.handler = handler;
+	sim.thread_fn = thread_fn;
+	sim.dev_id = dev_id;
+	return 0;
+}
+
+void free_irq(unsigned int irq, void *dev_id)
+{
+	if (sim.dev_id == dev_id)
+		sim.handler = sim.thread_fn = NULL;
+}
+
+static void sim_devm_free_irq(struct device *dev, void *data)
+{
+	free_irq(SIM_IRQ, data);
+}
+
+int devm_request_threaded_irq(struct device *dev, unsigned int irq,
+		irq_handler_t handler, irq_handler_t thread_fn,
+		unsigned long flags, const char *name, void *dev_id)
+{
+	int error;
+
+	error = request_threaded_irq(irq, handler, thread_fn, flags,
+			name, dev_id);
+	if (!error)
+		sim_devres_add(dev, sim_devm_free_irq, dev_id);
+	return error;
+}
+
+void devm_free_irq(struct device *dev, unsigned int irq, void *dev_id)
+{
+	/* WARN_ON() in the kernel */
+	if (sim_devres_destroy(dev, sim_devm_free_irq, dev_id)) {
+		fprintf(stderr, "sim: devm_free_irq of an unmanaged irq\n");
+		exit(1);
+	}
+	free_irq(irq, dev_id);
+}
+
+static irqreturn_t sim_irq(void)
+{
+	irqreturn_t ret;
+
+	if (!sim.handler)
+		return IRQ_NONE;
+
+	ret = sim.handler(SIM_IRQ, sim.dev_id);
+	if (ret == IRQ_WAKE_THREAD)
+		ret = sim.thread_fn(SIM_IRQ, sim.dev_id);
+
+	sim.irqs++;
+	if (ret == IRQ_NONE)
+		sim.irqs_none++;
+
+	return ret;
+}
+
+
+struct input_dev *input_allocate_device(void)
+{
+	return calloc(1, sizeof(struct input_dev));
+}
+
+void input_free_device(struct input_dev *dev)
+{
+	free(dev);
+}
+
+int input_register_device(struct input_dev *dev)
+{
+	int i;
+
+	/* same as the input core, KEY_RESERVED is never reported */
+	__clear_bit(KEY_RESERVED, dev->keybit);
+
+	for (i = 0; i < ARRAY_SIZE(sim.idevs); i++) {
+		if (!sim.idevs[i]) {
+			sim.idevs[i] = dev;
+			return 0;
+		}
+	}
+
+	return -ENOMEM;
+}
+
+void input_unregister_device(struct input_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.idevs); i++)
+		if (sim.idevs[i] == dev)
+			sim.idevs[i] = NULL;
+	free(dev);
+}
+
+int input_scancode_to_scalar(const struct input_keymap_entry *ke,
+		unsigned int *scancode)
+{
+	if (ke->len != sizeof(u32))
+		return -EINVAL;
+
+	memcpy(scancode, ke->scancode, sizeof(u32));
+	return 0;
+}
+
+/* input device selected with "device", the first one otherwise */
+static struct input_dev *sim_input_device(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.idevs); i++)
+		if (sim.idevs[i] && (!sim.device ||
+		    strcmp(sim.idevs[i]->phys, sim.device) == 0))
+			return sim.idevs[i];
+
+	return NULL;
+}
+
+static unsigned long *sim_capabilities(struct input_dev *dev,
+		unsigned int type)
+{
+	switch (type) {
+	case EV_KEY: return dev->keybit;
+	case EV_MSC: return dev->mscbit;
+	case EV_SW:  return dev->swbit;
+	default:     return NULL;
+	}
+}
+
+void input_set_capability(struct input_dev *dev, unsigned int type,
+		unsigned int code)
+{
+	unsigned long *bits = sim_capabilities(dev, type);
+
+	if (bits)
+		__set_bit(code, bits);
+	__set_bit(type, dev->evbit);
+}
+
+static void sim_record(struct input_dev *dev,
+		unsigned int type, unsigned int code, int value)
+{
+	struct sim_event *ev;
+
+	sim.n_passed++;
+	if (type == EV_SYN)
+		sim.n_frames++;
+
+	if (sim.verbose)
+		fprintf(stderr, "  event %s %u %u %d\n",
+				dev->phys, type, code, value);
+
+	if (!sim.record)
+		return;
+
+	/* the values change from run to run, only check them on request */
+	if (type == EV_MSC && code == MSC_TIMESTAMP && !sim.timestamps)
+		return;
+
+	if (sim.n_events == sim.max_events) {
+		sim.max_events = sim.max_events ? 2 * sim.max_events : 64;
+		sim.events = realloc(sim.events,
+				sim.max_events * sizeof(*sim.events));
+		if (!sim.events)
+			exit(2);
+	}
+
+	ev = &sim.events[sim.n_events++];
+	snprintf(ev->phys, sizeof(ev->phys), "%s", dev->phys);
+	ev->consumed = 0;
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+/* same as input_set_keycode() */
+static int sim_set_keycode(struct input_dev *dev, unsigned int scancode,
+		unsigned int keycode)
+{
+	struct input_keymap_entry ke = {
+		.len = sizeof(scancode),
+		.keycode = keycode,
+	};
+	unsigned int old_keycode;
+	unsigned long flags;
+	int error;
+
+	memcpy(ke.scancode, &scancode, sizeof(scancode));
+
+	spin_lock_irqsave(&dev->event_lock, flags);
+	error = dev->setkeycode(dev, &ke, &old_keycode);
+	spin_unlock_irqrestore(&dev->event_lock, flags);
+	if (error)
+		return error;
+
+	__clear_bit(KEY_RESERVED, dev->keybit);
+
+	/* simulate keyup event if keycode is not present anymore */
+	if (!test_bit(old_keycode, dev->keybit) &&
+	    test_bit(old_keycode, dev->key)) {
+		__clear_bit(old_keycode, dev->key);
+		sim_record(dev, EV_KEY, old_keycode, 0);
+		dev->sync = 0;
+		input_sync(dev);
+	}
+
+	return 0;
+}
+
+static int sim_get_keycode(struct input_dev *dev, unsigned int scancode,
+		unsigned int *keycode)
+{
+	struct input_keymap_entry ke = {
+		.len = sizeof(scancode),
+	};
+	int error;
+
+	memcpy(ke.scancode, &scancode, sizeof(scancode));
+
+	error = dev->getkeycode(dev, &ke);
+	if (!error)
+		*keycode = ke.keycode;
+	return error;
+}
+
+/* filters events the same way as input_handle_event() */
+void input_event(struct input_dev *dev, unsigned int type,
+		unsigned int code, int value)
+{
+	unsigned long *bits;
+
+	switch (type) {
+	case EV_SYN:
+		if (code != SYN_REPORT || dev->sync)
+			return;
+		dev->sync = 1;
+		break;
+
+	case EV_KEY:
+	case EV_SW:
+		bits = (type == EV_KEY) ? dev->key : dev->sw;
+		if (!test_bit(code, sim_capabilities(dev, type)) ||
+		    test_bit(code, bits) == !!value)
+			return;
+		if (value)
+			__set_bit(code, bits);
+		else
+			__clear_bit(code, bits);
+		dev->sync = 0;
+		break;
+
+	case EV_MSC:
+		if (!test_bit(code, dev->mscbit))
+			return;
+		dev->sync = 0;
+		break;
+
+	default:
+		return;
+	}
+
+	sim_record(dev, type, code, value);
+}
+
+
+acpi_status acpi_walk_resources(acpi_handle handle, const char *name,
+		acpi_walk_resource_callback cb, void *context)
+{
+	struct acpi_resource res[3];
+	acpi_status status;
+	int i;
+
+	memset(res, 0, sizeof(res));
+	res[0].type = ACPI_RESOURCE_TYPE_IRQ;
+	res[0].data.irq.interrupts[0] = SIM_IRQ;
+	res[1].type = ACPI_RESOURCE_TYPE_IO;
+	res[1].data.io.minimum = SIM_IO_BASE;
+	res[1].data.io.address_length = SIM_IO_LEN;
+	res[2].type = ACPI_RESOURCE_TYPE_END_TAG;
+
+	for (i = sim.noirq ? 1 : 0; i < ARRAY_SIZE(res); i++) {
+		status = cb(&res[i], context);
+		if (ACPI_FAILURE(status))
+			return status;
+	}
+
+	return AE_OK;
+}
+
+int acpi_bus_register_driver(struct acpi_driver *driver)
+{
+	sim.driver = driver;
+	strcpy(sim.adev.pnp.hardware_id, driver->ids[0].id);
+	sim.adev.dev.name = "FUJ02BD:00";
+
+	/* like the driver core, a failed probe doesn't fail the register */
+	if (driver->ops.add(&sim.adev)) {
+		sim_devres_release_all(&sim.adev.dev);
+		sim.driver = NULL;
+	}
+	return 0;
+}
+
+void acpi_bus_unregister_driver(struct acpi_driver *driver)
+{
+	if (sim.driver) {
+		driver->ops.remove(&sim.adev, 0);
+		sim_devres_release_all(&sim.adev.dev);
+	}
+	sim.driver = NULL;
+}
+
+int dmi_check_system(const struct dmi_system_id *list)
+{
+	const struct dmi_system_id *d;
+	int i, count = 0;
+
+	for (d = list; d->matches[0].slot != DMI_NONE; d++) {
+		for (i = 0; i < ARRAY_SIZE(d->matches); i++) {
+			int s = d->matches[i].slot;
+			if (s == DMI_NONE)
+				continue;
+			if (!strstr(sim.dmi[s], d->matches[i].substr))
+				break;
+		}
+		if (i < ARRAY_SIZE(d->matches))
+			continue;
+
+		count++;
+		if (d->callback && d->callback(d))
+			break;
+	}
+
+	return count;
+}
+
+
+static size_t param_size(const char *type)
+{
+	if (strcmp(type, "bool") == 0)
+		return sizeof(bool);
+	return sizeof(int);
+}
+
+void sim_register_param(const char *name, const char *type, void *value,
+		unsigned int perm)
+{
+	if (sim.n_params < ARRAY_SIZE(sim.params)) {
+		sim.params[sim.n_params].name = name;
+		sim.params[sim.n_params].type = type;
+		sim.params[sim.n_params].value = value;
+		sim.params[sim.n_params].writable = perm & S_IWUSR;
+		memcpy(&sim.params[sim.n_params].def, value, param_size(type));
+		sim.n_params++;
+	}
+}
+
+static int set_param(const char *name, const char *value)
+{
+	int i;
+
+	for (i = 0; i < sim.n_params; i++) {
+		if (strcmp(sim.params[i].name, name) != 0)
+			continue;
+
+		if (sim.probed && !sim.params[i].writable)
+			return -EPERM;
+
+		if (strcmp(sim.params[i].type, "bool") == 0)
+			*(bool *) sim.params[i].value = strtoul(value, NULL, 0);
+		else if (strcmp(sim.params[i].type, "int") == 0)
+			*(int *) sim.params[i].value = strtol(value, NULL, 0);
+		else if (strcmp(sim.params[i].type, "uint") == 0)
+			*(unsigned int *) sim.params[i].value =
+				strtoul(value, NULL, 0);
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static struct dentry *debugfs_add(const char *name, struct dentry *parent)
+{
+	struct dentry *d;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.debugfs); i++) {
+		d = &sim.debugfs[i];
+		if (d->used)
+			continue;
+
+		snprintf(d->path, sizeof(d->path), "%s%s%s",
+				parent ? parent->path : "",
+				parent ? "/" : "", name);
+		d->value = NULL;
+		d->fops = NULL;
+		d->data = NULL;
+		d->used = 1;
+		return d;
+	}
+
+	return NULL;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return debugfs_add(name, parent);
+}
+
+struct dentry *debugfs_create_u32(const char *name, unsigned short mode,
+		struct dentry *parent, u32 *value)
+{
+	struct dentry *d = debugfs_add(name, parent);
+
+	if (d)
+		d->value = value;
+	return d;
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned short mode,
+		struct dentry *parent, void *data,
+		const struct file_operations *fops)
+{
+	struct dentry *d = debugfs_add(name, parent);
+
+	if (d) {
+		d->fops = fops;
+		d->data = data;
+	}
+	return d;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+	size_t len;
+	int i;
+
+	if (!dentry)
+		return;
+
+	len = strlen(dentry->path);
+	for (i = 0; i < ARRAY_SIZE(sim.debugfs); i++) {
+		struct dentry *d = &sim.debugfs[i];
+		if (d != dentry && strncmp(d->path, dentry->path, len) == 0 &&
+		    d->path[len] == '/')
+			d->used = 0;
+	}
+	dentry->used = 0;
+}
+
+int sysfs_create_bin_file(struct kobject *kobj,
+		const struct bin_attribute *attr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.sysfs); i++) {
+		if (!sim.sysfs[i].kobj) {
+			sim.sysfs[i].kobj = kobj;
+			sim.sysfs[i].attr = attr;
+			return 0;
+		}
+	}
+
+	return -ENOMEM;
+}
+
+void sysfs_remove_bin_file(struct kobject *kobj,
+		const struct bin_attribute *attr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.sysfs); i++)
+		if (sim.sysfs[i].kobj == kobj && sim.sysfs[i].attr == attr)
+			sim.sysfs[i].kobj = NULL;
+}
+
+static const struct bin_attribute *sysfs_find(struct kobject *kobj,
+		const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.sysfs); i++)
+		if (sim.sysfs[i].kobj == kobj &&
+		    strcmp(sim.sysfs[i].attr->attr.name, name) == 0)
+			return sim.sysfs[i].attr;
+
+	return NULL;
+}
+
+int device_create_file(struct device *dev,
+		const struct device_attribute *attr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.attrs); i++) {
+		if (!sim.attrs[i].dev) {
+			sim.attrs[i].dev = dev;
+			sim.attrs[i].attr = attr;
+			return 0;
+		}
+	}
+
+	return -ENOMEM;
+}
+
+void device_remove_file(struct device *dev,
+		const struct device_attribute *attr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.attrs); i++)
+		if (sim.attrs[i].dev == dev && sim.attrs[i].attr == attr)
+			sim.attrs[i].dev = NULL;
+}
+
+int sysfs_create_group(struct kobject *kobj,
+		const struct attribute_group *grp)
+{
+	struct device *dev = container_of(kobj, struct device, kobj);
+	struct attribute **attr;
+	int error;
+
+	for (attr = grp->attrs; *attr; attr++) {
+		error = device_create_file(dev, container_of(*attr,
+					struct device_attribute, attr));
+		if (error) {
+			sysfs_remove_group(kobj, grp);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+void sysfs_remove_group(struct kobject *kobj,
+		const struct attribute_group *grp)
+{
+	struct device *dev = container_of(kobj, struct device, kobj);
+	struct attribute **attr;
+
+	for (attr = grp->attrs; *attr; attr++)
+		device_remove_file(dev, container_of(*attr,
+					struct device_attribute, attr));
+}
+
+static void uevent_log(const char *fmt, ...)
+{
+	va_list ap;
+	char buf[128], *text;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	text = strdup(buf);
+	if (!text)
+		exit(2);
+
+	if (sim.verbose)
+		fprintf(stderr, "  uevent %s\n", text);
+
+	sim.uevents = realloc(sim.uevents,
+			(sim.n_uevents + 1) * sizeof(*sim.uevents));
+	if (!sim.uevents)
+		exit(2);
+	sim.uevents[sim.n_uevents++] = text;
+}
+
+void sysfs_notify(struct kobject *kobj, const char *dir, const char *attr)
+{
+	uevent_log("notify %s", attr);
+}
+
+int kobject_uevent_env(struct kobject *kobj, enum kobject_action action,
+		char *envp[])
+{
+	char text[128] = "change";
+	int i;
+
+	if (action != KOBJ_CHANGE)
+		return -EINVAL;
+
+	/* udev gets the change after the input frame with it */
+	for (i = 0; i < ARRAY_SIZE(sim.idevs); i++)
+		if (sim.idevs[i] && !sim.idevs[i]->sync) {
+			fprintf(stderr, "sim: uevent in the middle of a frame\n");
+			exit(1);
+		}
+
+	for (i = 0; envp[i]; i++)
+		snprintf(text + strlen(text), sizeof(text) - strlen(text),
+				" %s", envp[i]);
+
+	uevent_log("%s", text);
+	return 0;
+}
+
+static int attrs_left(struct device *dev)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.attrs); i++)
+		if (sim.attrs[i].dev == dev)
+			return 1;
+
+	return 0;
+}
+
+/* an attribute of the selected input device or of the acpi device */
+static struct device_attribute *attr_find(const char *name,
+		struct device **dev)
+{
+	struct input_dev *idev = sim_input_device();
+	int i, j;
+
+	for (j = 0; j < 2; j++) {
+		*dev = j ? &sim.adev.dev : idev ? &idev->dev : NULL;
+		for (i = 0; i < ARRAY_SIZE(sim.attrs); i++)
+			if (*dev && sim.attrs[i].dev == *dev &&
+			    strcmp(sim.attrs[i].attr->attr.name, name) == 0)
+				return (struct device_attribute *)
+					sim.attrs[i].attr;
+	}
+
+	return NULL;
+}
+
+/*
+ * Changes one entry (or the quirks if index is -1) of the sysfs keymap
+ * file of the selected device by rewriting the whole file, which has
+ * little endian 16 bit keycodes followed by the 32 bit quirks.
+ */
+static ssize_t update_keymap(int index, unsigned int value)
+{
+	struct input_dev *dev = sim_input_device();
+	const struct bin_attribute *attr;
+	struct bin_attribute *a;
+	char buf[256];
+	u16 keycode = htole16(value);
+	u32 quirks = htole32(value);
+	ssize_t n;
+
+	if (!dev)
+		return -ENODEV;
+
+	attr = sysfs_find(&dev->dev.kobj, "keymap");
+	if (!attr || attr->size > sizeof(buf))
+		return -ENOENT;
+	a = (struct bin_attribute *) attr;
+
+	n = attr->read(NULL, &dev->dev.kobj, a, buf, 0, attr->size);
+	if (n != attr->size)
+		return n < 0 ? n : -EIO;
+
+	if (index < 0)
+		memcpy(buf + attr->size - sizeof(quirks), &quirks,
+				sizeof(quirks));
+	else
+		memcpy(buf + index * sizeof(keycode), &keycode,
+				sizeof(keycode));
+
+	return attr->write(NULL, &dev->dev.kobj, a, buf, 0, attr->size);
+}
+
+static ssize_t write_debugfs(const char *path, const char *text)
+{
+	struct dentry *d;
+	struct inode inode;
+	struct file file;
+	loff_t pos = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.debugfs); i++) {
+		d = &sim.debugfs[i];
+		if (!d->used || strcmp(d->path, path) != 0 ||
+		    !d->fops || !d->fops->write)
+			continue;
+
+		inode.i_private = d->data;
+		file.private_data = d->data;
+		if (d->fops->open && d->fops->open(&inode, &file))
+			return -EIO;
+		return d->fops->write(&file, text, strlen(text), &pos);
+	}
+
+	return -ENOENT;
+}
+
+static u32 *debugfs_value(const char *path)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.debugfs); i++)
+		if (sim.debugfs[i].used &&
+		    strcmp(sim.debugfs[i].path, path) == 0)
+			return sim.debugfs[i].value;
+
+	return NULL;
+}
+
+static int cat_debugfs(const char *path)
+{
+	struct inode inode;
+	struct dentry *d;
+	struct file file;
+	char buf[4096];
+	loff_t pos = 0;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.debugfs); i++) {
+		d = &sim.debugfs[i];
+		if (!d->used || strcmp(d->path, path) != 0)
+			continue;
+
+		if (d->value) {
+			printf("%u\n", *d->value);
+			return 0;
+		}
+		if (!d->fops || !d->fops->read)
+			return -EINVAL;
+
+		inode.i_private = d->data;
+		file.private_data = d->data;
+		if (d->fops->open && d->fops->open(&inode, &file))
+			return -EIO;
+
+		while ((n = d->fops->read(&file, buf, sizeof(buf), &pos)) > 0)
+			fwrite(buf, 1, n, stdout);
+
+		if (d->fops->release)
+			d->fops->release(&inode, &file);
+		return n;
+	}
+
+	return -ENOENT;
+}
+
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(m->buf + m->count, sizeof(m->buf) - m->count, fmt, ap);
+	va_end(ap);
+
+	if (n < 0 || m->count + n >= sizeof(m->buf))
+		return -1;
+
+	m->count += n;
+	return 0;
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	struct seq_file *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return -ENOMEM;
+
+	m->show = show;
+	m->private = data;
+	file->private_data = m;
+	return 0;
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	size_t n;
+
+	if (*ppos == 0) {
+		m->count = 0;
+		m->show(m, NULL);
+	}
+
+	if (*ppos >= m->count)
+		return 0;
+
+	n = min(size, m->count - (size_t) *ppos);
+	memcpy(buf, m->buf + *ppos, n);
+	*ppos += n;
+	return n;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	free(file->private_data);
+	return 0;
+}
+
+
+#define N(type, code) { type, code, #code }
+
+static const struct {
+	unsigned int type, code;
+	const char *name;
+} names[] = {
+	N(EV_SYN, EV_SYN), N(EV_KEY, EV_KEY), N(EV_MSC, EV_MSC), N(EV_SW, EV_SW),
+
+	N(EV_SYN, SYN_REPORT),
+	N(EV_MSC, MSC_SCAN), N(EV_MSC, MSC_RAW),
+	N(EV_MSC, MSC_TIMESTAMP),
+	N(EV_SW, SW_DOCK), N(EV_SW, SW_TABLET_MODE),
+
+	N(EV_KEY, KEY_RESERVED),
+	N(EV_KEY, KEY_SCROLLDOWN), N(EV_KEY, KEY_SCROLLUP),
+	N(EV_KEY, KEY_PROG1), N(EV_KEY, KEY_PROG2),
+	N(EV_KEY, KEY_PROG3), N(EV_KEY, KEY_PROG4), N(EV_KEY, KEY_SLEEP),
+	N(EV_KEY, KEY_DIRECTION), N(EV_KEY, KEY_DASHBOARD),
+	N(EV_KEY, KEY_FN), N(EV_KEY, KEY_LEFTALT), N(EV_KEY, KEY_SETUP),
+	N(EV_KEY, KEY_BRIGHTNESSUP), N(EV_KEY, KEY_BRIGHTNESSDOWN),
+	N(EV_KEY, KEY_BRIGHTNESS_ZERO),
+	N(EV_KEY, BTN_1), N(EV_KEY, BTN_2), N(EV_KEY, BTN_3), N(EV_KEY, BTN_4),
+	N(EV_KEY, KEY_UP), N(EV_KEY, KEY_DOWN),
+	N(EV_KEY, KEY_LEFT), N(EV_KEY, KEY_RIGHT),
+	N(EV_KEY, KEY_HOME), N(EV_KEY, KEY_END),
+	N(EV_KEY, KEY_PAGEUP), N(EV_KEY, KEY_PAGEDOWN),
+	N(EV_KEY, KEY_PRINT), N(EV_KEY, KEY_WWW), N(EV_KEY, KEY_MAIL),
+	N(EV_KEY, KEY_BACKSPACE), N(EV_KEY, KEY_SCREEN),
+	N(EV_KEY, KEY_SPACE), N(EV_KEY, KEY_ENTER), N(EV_KEY, KEY_ESC),
+};
+
+#undef N
+
+static int lookup_name(const char *name, unsigned int *value)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (strcmp(names[i].name, name) == 0) {
+			*value = names[i].code;
+			return 0;
+		}
+	}
+
+	*value = strtoul(name, &end, 0);
+	return (*name && !*end) ? 0 : -1;
+}
+
+static const char *code_name(unsigned int type, unsigned int code, int is_type)
+{
+	static char buf[8][16];
+	static int n;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (is_type ? (names[i].type == code && names[i].code == code &&
+				strncmp(names[i].name, "EV_", 3) == 0)
+			    : (names[i].type == type && names[i].code == code &&
+				strncmp(names[i].name, "EV_", 3) != 0))
+			return names[i].name;
+	}
+
+	n = (n + 1) % 8;
+	snprintf(buf[n], sizeof(buf[n]), "%u", code);
+	return buf[n];
+}
+
+static void print_stats(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim.debugfs); i++)
+		if (sim.debugfs[i].used && sim.debugfs[i].value)
+			printf("%s: %u\n", sim.debugfs[i].path,
+					*sim.debugfs[i].value);
+
+	printf("interrupts: %lu (%lu not handled)\n",
+			sim.irqs, sim.irqs_none);
+	printf("events: %lu in %lu frames (%.2f frames/irq)\n",
+			sim.n_passed, sim.n_frames,
+			sim.irqs ? (double) sim.n_frames / sim.irqs : 0.0);
+}
+
+/* next unchecked event of the selected device */
+static struct sim_event *next_event(void)
+{
+	struct sim_event *ev;
+	unsigned int i;
+
+	while (sim.next_event < sim.n_events &&
+	       sim.events[sim.next_event].consumed)
+		sim.next_event++;
+
+	for (i = sim.next_event; i < sim.n_events; i++) {
+		ev = &sim.events[i];
+		if (!ev->consumed &&
+		    (!sim.device || strcmp(ev->phys, sim.device) == 0))
+			return ev;
+	}
+
+	return NULL;
+}
+
+static void set_keys(unsigned int keymask)
+{
+	/* the keymask registers are active low */
+	hw.regs[0xde] = ~keymask & 0xff;
+	hw.regs[0xdf] = (~keymask >> 8) & 0xff;
+}
+
+static void reset(void)
+{
+	int i;
+
+	memset(&hw, 0, sizeof(hw));
+	set_keys(0);
+
+	/* as after loading the module again, the quirks are or'ed in */
+	memset(&fujitsu_config, 0, sizeof(fujitsu_config));
+
+	for (i = 0; i < sim.n_params; i++)
+		memcpy(sim.params[i].value, &sim.params[i].def,
+				param_size(sim.params[i].type));
+
+	sim.n_events = sim.next_event = 0;
+	while (sim.n_uevents)
+		free(sim.uevents[--sim.n_uevents]);
+	sim.next_uevent = 0;
+	free(sim.device);
+	sim.device = NULL;
+	sim.irqs = sim.irqs_none = 0;
+	sim.n_passed = sim.n_frames = 0;
+	sim.noirq = 0;
+	sim.timestamps = 0;
+}
+
+static void probe(void)
+{
+	int error;
+
+	/* unless set by "busy" the controller is ready on the first poll */
+	if (!(hw.status & 0x02)) {
+		hw.status |= 0x02;
+		hw.ready = jiffies;
+	}
+
+	error = sim_module_init();
+	if (error) {
+		fprintf(stderr, "sim: module init failed (%d)\n", error);
+		exit(1);
+	}
+
+	sim.probed = 1;
+}
+
+static void raise_irq(void)
+{
+	hw.status |= 0x01;
+	sim_irq();
+}
+
+#define fail(fmt, a...) do { \
+	fprintf(stderr, "%s:%d: " fmt "\n", file, line, ##a); \
+	return 1; \
+} while (0)
+
+static int run_script(const char *file, FILE *fp)
+{
+	char buf[256], *cmd, *args;
+	unsigned int type, code, a, b;
+	int value;
+	int line = 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		line++;
+
+		buf[strcspn(buf, "#\r\n")] = '\0';
+		cmd = buf + strspn(buf, " \t");
+		if (!*cmd)
+			continue;
+
+		args = cmd + strcspn(cmd, " \t");
+		if (*args)
+			*args++ = '\0';
+		args += strspn(args, " \t");
+		while (*args && isspace(args[strlen(args) - 1]))
+			args[strlen(args) - 1] = '\0';
+
+		if (sim.verbose)
+			fprintf(stderr, "%s:%d: %s %s\n", file, line, cmd, args);
+
+		if (strcmp(cmd, "model") == 0) {
+			if (sim.probed)
+				fail("model has to be set before probe");
+			sim.dmi[DMI_PRODUCT_NAME] = strdup(args);
+		}
+		else if (strcmp(cmd, "noirq") == 0) {
+			if (sim.probed)
+				fail("noirq has to be set before probe");
+			sim.noirq = 1;
+		}
+		else if (strcmp(cmd, "probe") == 0) {
+			probe();
+		}
+		else if (strcmp(cmd, "remove") == 0) {
+			sim_module_exit();
+			sim.probed = 0;
+			if (hw.regions || sim.handler || sim.adev.dev.devres ||
+			    attrs_left(&sim.adev.dev))
+				fail("resources left after remove");
+			for (a = 0; a < ARRAY_SIZE(sim.timers); a++)
+				if (sim.timers[a])
+					fail("timer left after remove");
+		}
+		else if (strcmp(cmd, "state") == 0) {
+			if (sscanf(args, "%x", &a) != 1)
+				fail("state <hex>");
+			hw.regs[0xdd] = a;
+		}
+		else if (strcmp(cmd, "keys") == 0) {
+			if (sscanf(args, "%x", &a) != 1)
+				fail("keys <hex>");
+			set_keys(a);
+		}
+		else if (strcmp(cmd, "reg") == 0) {
+			if (sscanf(args, "%x %x", &a, &b) != 2 || a > 0xff)
+				fail("reg <addr> <value>");
+			hw.regs[a] = b;
+		}
+		else if (strcmp(cmd, "irq") == 0) {
+			raise_irq();
+		}
+		else if (strcmp(cmd, "busy") == 0) {
+			hw.status |= 0x02;
+			hw.ready = jiffies + strtoul(args, NULL, 0);
+		}
+		else if (strcmp(cmd, "resume") == 0) {
+			if (!sim.probed)
+				fail("resume without probe");
+			if (!sim.driver)
+				fail("resume without bound driver");
+			sim.driver->ops.resume(&sim.adev);
+		}
+		else if (strcmp(cmd, "spurious") == 0) {
+			if (sim_irq() != IRQ_NONE)
+				fail("spurious interrupt was handled");
+		}
+		else if (strcmp(cmd, "sleep") == 0) {
+			sim_sleep(strtoul(args, NULL, 0));
+		}
+		else if (strcmp(cmd, "stall") == 0) {
+			jiffies += strtoul(args, NULL, 0);
+			sim.stalled = 1;
+		}
+		else if (strcmp(cmd, "device") == 0) {
+			free(sim.device);
+			sim.device = *args ? strdup(args) : NULL;
+		}
+		else if (strcmp(cmd, "timestamps") == 0) {
+			sim.timestamps = strcmp(args, "off") != 0;
+		}
+		else if (strcmp(cmd, "expect") == 0) {
+			char t[32], c[32], v[32];
+			struct sim_event *ev;
+			int any;
+
+			if (sscanf(args, "%31s %31s %31s", t, c, v) != 3 ||
+			    lookup_name(t, &type) || lookup_name(c, &code))
+				fail("expect <type> <code> <value|*>");
+			any = strcmp(v, "*") == 0;
+			value = any ? 0 : strtol(v, NULL, 0);
+
+			ev = next_event();
+			if (!ev)
+				fail("expected %s %s %s, got nothing",
+						t, c, v);
+
+			ev->consumed = 1;
+			if (ev->type != type || ev->code != code ||
+			    (!any && ev->value != value))
+				fail("expected %s %s %s, got %s %s %d",
+					t, c, v,
+					code_name(0, ev->type, 1),
+					code_name(ev->type, ev->code, 0),
+					ev->value);
+		}
+		else if (strcmp(cmd, "none") == 0) {
+			struct sim_event *ev = next_event();
+
+			if (ev)
+				fail("expected no event, got %s %s %d from %s",
+					code_name(0, ev->type, 1),
+					code_name(ev->type, ev->code, 0),
+					ev->value, ev->phys);
+		}
+		else if (strcmp(cmd, "flush") == 0) {
+			sim.next_event = sim.n_events;
+		}
+		else if (strcmp(cmd, "stats") == 0) {
+			print_stats();
+		}
+		else if (strcmp(cmd, "check") == 0) {
+			char name[64];
+			u32 *v;
+
+			if (sscanf(args, "%63s %u", name, &a) != 2)
+				fail("check <file> <value>");
+			v = debugfs_value(name);
+			if (!v)
+				fail("no counter %s", name);
+			if (*v != a)
+				fail("%s is %u, expected %u", name, *v, a);
+		}
+		else if (strcmp(cmd, "store") == 0 ||
+			 strcmp(cmd, "show") == 0) {
+			struct device_attribute *attr;
+			struct device *dev;
+			char name[32], buf[4096];
+			ssize_t n;
+
+			if (sscanf(args, "%31s", name) != 1)
+				fail("%s <attribute> <text>", cmd);
+			args += strlen(name);
+			args += strspn(args, " \t");
+
+			attr = attr_find(name, &dev);
+			if (!attr)
+				fail("no attribute %s", name);
+
+			if (cmd[1] == 't') {
+				if (!attr->store)
+					fail("%s is read-only", name);
+				n = attr->store(dev, attr, args, strlen(args));
+				if (n < 0)
+					fail("store to %s failed (%zd)", name, n);
+			} else {
+				n = attr->show(dev, attr, buf);
+				if (n < 0)
+					fail("show %s failed (%zd)", name, n);
+				buf[n] = '\0';
+				buf[strcspn(buf, "\n")] = '\0';
+				if (strcmp(buf, args) != 0)
+					fail("%s is '%s', expected '%s'",
+							name, buf, args);
+			}
+		}
+		else if (strcmp(cmd, "uevent") == 0) {
+			const char *u;
+
+			u = NULL;
+			if (sim.next_uevent < sim.n_uevents)
+				u = sim.uevents[sim.next_uevent++];
+
+			/* without text no uevent may be left */
+			if (!*args && u)
+				fail("expected no uevent, got '%s'", u);
+			if (*args && !u)
+				fail("expected uevent '%s', got nothing", args);
+			if (*args && strcmp(u, args) != 0)
+				fail("expected uevent '%s', got '%s'", args, u);
+		}
+		else if (strcmp(cmd, "cat") == 0) {
+			int error = cat_debugfs(args);
+
+			if (error < 0)
+				fail("cat %s failed (%d)", args, error);
+		}
+		else if (strcmp(cmd, "param") == 0) {
+			char name[32], value[32];
+			int error;
+
+			if (sscanf(args, "%31s %31s", name, value) != 2)
+				fail("param <name> <value>");
+			error = set_param(name, value);
+			if (error == -EPERM)
+				fail("parameter '%s' is read-only after probe",
+						name);
+			if (error)
+				fail("unknown parameter '%s'", name);
+		}
+		else if (strcmp(cmd, "write") == 0) {
+			char name[32];
+			ssize_t n;
+
+			if (sscanf(args, "%31s", name) != 1)
+				fail("write <file> <text>");
+			args += strlen(name);
+			args += strspn(args, " \t");
+
+			n = write_debugfs(name, args);
+			if (n < 0)
+				fail("write to %s failed (%zd)", name, n);
+		}
+		else if (strcmp(cmd, "setkeycode") == 0 ||
+			 strcmp(cmd, "getkeycode") == 0 ||
+			 strcmp(cmd, "keymap") == 0) {
+			struct input_dev *dev = sim_input_device();
+			char c[32];
+			int error;
+
+			if (sscanf(args, "%u %31s", &a, c) != 2 ||
+			    lookup_name(c, &code))
+				fail("%s <scancode> <keycode>", cmd);
+			if (!dev)
+				fail("no input device");
+
+			if (cmd[0] == 's') {
+				error = sim_set_keycode(dev, a, code);
+			} else if (cmd[0] == 'g') {
+				error = sim_get_keycode(dev, a, &b);
+				if (!error && b != code)
+					fail("scancode %u is %s, expected %s",
+						a, code_name(EV_KEY, b, 0), c);
+			} else {
+				/* file layout is keymap[bit][column] */
+				error = update_keymap((a % 16) * 3 + a / 16,
+						code);
+			}
+
+			if (error < 0)
+				fail("%s %u failed (%d)", cmd, a, error);
+		}
+		else if (strcmp(cmd, "quirks") == 0) {
+			ssize_t n;
+
+			if (sscanf(args, "%x", &a) != 1)
+				fail("quirks <hex>");
+
+			n = update_keymap(-1, a);
+			if (n < 0)
+				fail("quirks failed (%zd)", n);
+		}
+		else {
+			fail("unknown command '%s'", cmd);
+		}
+
+		/* pending work runs before the next command */
+		if (!sim.stalled)
+			sim_run_timers();
+	}
+
+	return 0;
+}
+
+static int benchmark(unsigned long count)
+{
+	struct timespec start, end;
+	unsigned int keymask = 0;
+	unsigned long i;
+	u32 seed = 1;
+	double ns;
+
+	sim.record = 0;
+	probe();
+	sim_run_timers();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+
+		/* mostly scroll wheel and buttons, sometimes a switch */
+		if ((seed >> 16) % 64 == 0)
+			hw.regs[0xdd] ^= 0x01;
+		else
+			keymask ^= BIT(4 + (seed >> 16) % 4);
+
+		set_keys(keymask);
+		raise_irq();
+
+		if (i % 256 == 0)
+			sim_sleep(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	print_stats();
+	printf("%lu interrupts in %.3f ms, %.1f ns/irq\n",
+			count, ns / 1e6, ns / count);
+
+	sim_module_exit();
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-v] [script...]\n"
+			"       %s [-v] [-m model] -b <count>\n", prog, prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long count = 0;
+	const char *model;
+	FILE *fp;
+	int opt, i;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "b:m:vh")) != -1) {
+		switch (opt) {
+		case 'b':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			sim.dmi[DMI_PRODUCT_NAME] = optarg;
+			break;
+		case 'v':
+			sim.verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	reset();
+	model = sim.dmi[DMI_PRODUCT_NAME];
+
+	if (count)
+		return benchmark(count);
+
+	if (optind == argc)
+		return run_script("<stdin>", stdin);
+
+	for (i = optind; i < argc && !ret; i++) {
+		fp = fopen(argv[i], "r");
+		if (!fp) {
+			perror(argv[i]);
+			return 2;
+		}
+
+		ret = run_script(argv[i], fp);
+		fclose(fp);
+
+		if (sim.probed) {
+			sim_module_exit();
+			sim.probed = 0;
+		}
+		reset();
+
+		/* every script starts with the default model */
+		sim.dmi[DMI_PRODUCT_NAME] = model;
+	}
+
+	return ret;
+}
@@ -0,0 +1,850 @@
+/*
+ * Copyright (C) 2012 Robert Gerlach <khnz@gmx.de>
+ *
+ * You can redistribute and/or modify this program under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Minimal userspace replacement of the kernel interfaces used by
+ * fujitsu-tablet.c. Only what the driver needs is provided, and only
+ * as far as the simulation needs it.
+ */
+
+#ifndef _FUJITSU_TABLET_SIM_H
+#define _FUJITSU_TABLET_SIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/types.h>
+#include <linux/input.h>
+
+/* compiler, module and section annotations */
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define ACCESS_ONCE(x)	(*(volatile typeof(x) *)&(x))
+
+#define cpu_to_le16(x)	htole16(x)
+#define cpu_to_le32(x)	htole32(x)
+#define le16_to_cpu(x)	le16toh(x)
+#define le32_to_cpu(x)	le32toh(x)
+
+#define xchg(ptr, v)	__sync_lock_test_and_set((ptr), (v))
+
+#define __init
+#define __exit
+#define __initconst
+#define __devinit
+#define __devexit
+
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define MODULE_VERSION(x)
+#define MODULE_DEVICE_TABLE(type, name)
+#define MODULE_PARM_DESC(name, desc)
+
+#define THIS_MODULE	NULL
+
+/* module parameters can be set with the 'param' script command */
+#define module_param(name, type, perm) \
+	static void __attribute__((constructor)) sim_param_##name(void) \
+	{ \
+		sim_register_param(#name, #type, &name, perm); \
+	}
+
+void sim_register_param(const char *name, const char *type, void *value,
+		unsigned int perm);
+
+#define module_init(fn)	int sim_module_init(void) { return fn(); }
+#define module_exit(fn)	void sim_module_exit(void) { fn(); }
+
+int sim_module_init(void);
+void sim_module_exit(void);
+
+#define KERN_ERR	"<3>"
+#define KERN_WARNING	"<4>"
+#define KERN_INFO	"<6>"
+#define KERN_DEBUG	"<7>"
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* types and bit operations */
+
+typedef __u8  u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s64 s64;
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define BITS_PER_LONG	(8 * sizeof(long))
+#define BIT(nr)		(1UL << (nr))
+
+static inline void __set_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= BIT(nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~BIT(nr % BITS_PER_LONG);
+}
+
+static inline void set_bit(int nr, unsigned long *addr)
+{
+	__sync_fetch_and_or(&addr[nr / BITS_PER_LONG],
+			BIT(nr % BITS_PER_LONG));
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline int sim_find_next_bit(const unsigned long *addr,
+		int size, int offset)
+{
+	while (offset < size && !test_bit(offset, addr))
+		offset++;
+	return offset;
+}
+
+#define for_each_set_bit(bit, addr, size) \
+	for ((bit) = sim_find_next_bit((addr), (size), 0); \
+	     (bit) < (size); \
+	     (bit) = sim_find_next_bit((addr), (size), (bit) + 1))
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#define max(x, y)	((x) > (y) ? (x) : (y))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define IS_ERR_OR_NULL(ptr)	(!(ptr) || (unsigned long)(ptr) >= (unsigned long)-4095)
+
+/* memory and lists */
+
+#define GFP_KERNEL	0
+#define GFP_ATOMIC	0
+
+static inline void *kzalloc(size_t size, int flags)
+{
+	return calloc(1, size);
+}
+
+static inline void kfree(const void *ptr)
+{
+	free((void *) ptr);
+}
+
+static inline void *kmemdup(const void *src, size_t len, int flags)
+{
+	void *p = malloc(len);
+
+	if (p)
+		memcpy(p, src, len);
+	return p;
+}
+
+/* locking and rcu, the simulation is single threaded */
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define spin_lock_init(l)		((l)->locked = 0)
+#define spin_lock_irqsave(l, flags)	 ((flags) = 0, (l)->locked++)
+#define spin_unlock_irqrestore(l, flags) ((void) (flags), (l)->locked--)
+
+#define lockdep_is_held(l)	((l)->locked)
+
+#define __rcu
+
+struct rcu_head {
+	void *next;
+};
+
+#define rcu_read_lock()			do { } while (0)
+#define rcu_read_unlock()		do { } while (0)
+#define rcu_dereference(p)		(p)
+#define rcu_dereference_protected(p, c)	(p)
+#define rcu_assign_pointer(p, v)	((p) = (v))
+#define RCU_INIT_POINTER(p, v)		((p) = (v))
+
+/* there are no readers left when the writer returns */
+static inline void call_rcu(struct rcu_head *head,
+		void (*func)(struct rcu_head *head))
+{
+	func(head);
+}
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD(name) struct list_head name = { &(name), &(name) }
+
+static inline void list_add_tail(struct list_head *entry,
+		struct list_head *head)
+{
+	entry->next = head;
+	entry->prev = head->prev;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_entry((head)->next, typeof(*pos), member), \
+	     n = list_entry(pos->member.next, typeof(*pos), member); \
+	     &pos->member != (head); \
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+/* port i/o, see fujitsu-tablet-sim.c for the register model */
+
+u8 inb(unsigned long port);
+void outb(u8 value, unsigned long port);
+
+struct resource {
+	unsigned long start;
+};
+
+struct resource *request_region(unsigned long start, unsigned long n,
+		const char *name);
+void release_region(unsigned long start, unsigned long n);
+
+/* time */
+
+#define HZ 1000
+
+extern unsigned long jiffies;
+
+#define time_before(a, b)	((long)((a) - (b)) < 0)
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+
+static inline unsigned long msecs_to_jiffies(unsigned int m)
+{
+	return m * HZ / 1000;
+}
+
+struct timer_list {
+	unsigned long expires;
+	void (*function)(unsigned long);
+	unsigned long data;
+	int pending;
+};
+
+void init_timer(struct timer_list *timer);
+
+static inline void setup_timer(struct timer_list *timer,
+		void (*function)(unsigned long), unsigned long data)
+{
+	init_timer(timer);
+	timer->function = function;
+	timer->data = data;
+}
+
+void add_timer(struct timer_list *timer);
+int del_timer(struct timer_list *timer);
+int mod_timer(struct timer_list *timer, unsigned long expires);
+int del_timer_sync(struct timer_list *timer);
+
+static inline unsigned int jiffies_to_msecs(unsigned long j)
+{
+	return j * 1000 / HZ;
+}
+
+/* monotonic clock in ns, the only time that is not simulated */
+
+typedef s64 ktime_t;
+
+ktime_t ktime_get(void);
+
+#define ktime_add(a, b)		((a) + (b))
+#define ktime_sub(a, b)		((a) - (b))
+#define ktime_to_ns(kt)		(kt)
+#define ktime_to_us(kt)		((kt) / 1000)
+#define ns_to_ktime(ns)		((ktime_t) (ns))
+
+#define NSEC_PER_MSEC		1000000L
+
+/* work items run from the timers, between the script commands */
+
+struct work_struct {
+	void (*func)(struct work_struct *work);
+	struct timer_list timer;
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+#define to_delayed_work(w)	container_of(w, struct delayed_work, work)
+
+static inline void sim_work_fn(unsigned long data)
+{
+	struct work_struct *work = (struct work_struct *) data;
+
+	work->func(work);
+}
+
+#define INIT_WORK(w, fn) do { \
+	(w)->func = (fn); \
+	setup_timer(&(w)->timer, sim_work_fn, (unsigned long) (w)); \
+} while (0)
+
+#define INIT_DELAYED_WORK(dwork, fn)	INIT_WORK(&(dwork)->work, fn)
+
+static inline int schedule_delayed_work(struct delayed_work *dwork,
+		unsigned long delay)
+{
+	if (dwork->work.timer.pending)
+		return 0;
+
+	mod_timer(&dwork->work.timer, jiffies + delay);
+	return 1;
+}
+
+static inline int schedule_work(struct work_struct *work)
+{
+	return schedule_delayed_work(to_delayed_work(work), 0);
+}
+
+static inline int cancel_work_sync(struct work_struct *work)
+{
+	return del_timer_sync(&work->timer);
+}
+
+static inline int cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	return cancel_work_sync(&dwork->work);
+}
+
+/* hrtimers on top of the simulated timers, rounded up to 1 ms */
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,
+	HRTIMER_MODE_REL,
+};
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+	struct timer_list timer;
+	ktime_t interval;
+};
+
+
+static inline unsigned long sim_ktime_to_jiffies(ktime_t kt)
+{
+	return (kt + 999999) / 1000000 * HZ / 1000;
+}
+
+static inline void sim_hrtimer_fn(unsigned long data)
+{
+	struct hrtimer *timer = (struct hrtimer *) data;
+
+	if (timer->function(timer) == HRTIMER_RESTART)
+		mod_timer(&timer->timer,
+			jiffies + sim_ktime_to_jiffies(timer->interval));
+}
+
+static inline void hrtimer_init(struct hrtimer *timer, clockid_t clock,
+		enum hrtimer_mode mode)
+{
+	setup_timer(&timer->timer, sim_hrtimer_fn, (unsigned long) timer);
+}
+
+/*
+ * A timer that is due but did not run yet (see "stall") counts as
+ * running its callback on another cpu.
+ */
+static inline int sim_hrtimer_running(struct hrtimer *timer)
+{
+	return timer->timer.pending &&
+		(long)(jiffies - timer->timer.expires) >= 0;
+}
+
+/* absolute times are from the real clock, see ktime_get() */
+static inline int hrtimer_start(struct hrtimer *timer, ktime_t tim,
+		enum hrtimer_mode mode)
+{
+	/* the running callback sees what the caller changed before */
+	if (sim_hrtimer_running(timer)) {
+		del_timer(&timer->timer);
+		timer->function(timer);
+	}
+
+	if (mode == HRTIMER_MODE_ABS)
+		tim = max(tim - ktime_get(), 0);
+
+	return mod_timer(&timer->timer, jiffies + sim_ktime_to_jiffies(tim));
+}
+
+/* fails on a running callback, which still runs with the next sleep */
+static inline int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	if (sim_hrtimer_running(timer))
+		return -1;
+
+	return del_timer(&timer->timer);
+}
+
+static inline u64 hrtimer_forward_now(struct hrtimer *timer,
+		ktime_t interval)
+{
+	timer->interval = interval;
+	return 1;
+}
+
+/* waits for a running callback, it does not restart the timer */
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	if (sim_hrtimer_running(timer)) {
+		del_timer(&timer->timer);
+		timer->function(timer);
+		return 1;
+	}
+
+	return del_timer_sync(&timer->timer);
+}
+
+/* interrupts */
+
+typedef enum {
+	IRQ_NONE = 0,
+	IRQ_HANDLED = 1,
+	IRQ_WAKE_THREAD = 2
+} irqreturn_t;
+
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+
+#define IRQF_SHARED	0x00000080
+
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+		irq_handler_t thread_fn, unsigned long flags,
+		const char *name, void *dev_id);
+void free_irq(unsigned int irq, void *dev_id);
+
+/* devices and input */
+
+struct kobject {
+	const char *name;
+};
+
+struct sim_devres;
+
+struct device {
+	struct kobject kobj;
+	struct device *parent;
+	const char *name;
+	struct sim_devres *devres;
+};
+
+/* managed resources, released in reverse order after remove */
+typedef void (*sim_devres_release_t)(struct device *dev, void *data);
+void sim_devres_add(struct device *dev, sim_devres_release_t release,
+		void *data);
+int sim_devres_destroy(struct device *dev, sim_devres_release_t release,
+		void *data);
+void sim_devres_release_all(struct device *dev);
+
+void *devm_kzalloc(struct device *dev, size_t size, int flags);
+struct resource *devm_request_region(struct device *dev,
+		unsigned long start, unsigned long n, const char *name);
+int devm_request_threaded_irq(struct device *dev, unsigned int irq,
+		irq_handler_t handler, irq_handler_t thread_fn,
+		unsigned long flags, const char *name, void *dev_id);
+void devm_free_irq(struct device *dev, unsigned int irq, void *dev_id);
+
+/* the sim is built like a built-in driver, async functions run right away */
+typedef unsigned long long async_cookie_t;
+typedef void (async_func_ptr)(void *data, async_cookie_t cookie);
+
+static inline async_cookie_t async_schedule(async_func_ptr *ptr, void *data)
+{
+	ptr(data, 0);
+	return 0;
+}
+
+static inline void async_synchronize_full(void)
+{
+}
+
+#define dev_name(d)	((d)->name)
+
+struct input_dev {
+	const char *name;
+	const char *phys;
+	struct input_id id;
+	struct device dev;
+
+	void *keycode;
+	unsigned int keycodesize;
+	unsigned int keycodemax;
+	int (*setkeycode)(struct input_dev *dev,
+			const struct input_keymap_entry *ke,
+			unsigned int *old_keycode);
+	int (*getkeycode)(struct input_dev *dev,
+			struct input_keymap_entry *ke);
+
+	spinlock_t event_lock;
+	void *drvdata;
+
+	unsigned long evbit[EV_CNT / (8 * sizeof(long)) + 1];
+	unsigned long keybit[KEY_CNT / (8 * sizeof(long)) + 1];
+	unsigned long mscbit[MSC_CNT / (8 * sizeof(long)) + 1];
+	unsigned long swbit[SW_CNT / (8 * sizeof(long)) + 1];
+
+	unsigned long key[KEY_CNT / (8 * sizeof(long)) + 1];
+	unsigned long sw[SW_CNT / (8 * sizeof(long)) + 1];
+	int sync;
+};
+
+#define to_input_dev(d)	container_of(d, struct input_dev, dev)
+
+static inline void input_set_drvdata(struct input_dev *dev, void *data)
+{
+	dev->drvdata = data;
+}
+
+static inline void *input_get_drvdata(struct input_dev *dev)
+{
+	return dev->drvdata;
+}
+
+int input_scancode_to_scalar(const struct input_keymap_entry *ke,
+		unsigned int *scancode);
+
+struct input_dev *input_allocate_device(void);
+void input_free_device(struct input_dev *dev);
+int input_register_device(struct input_dev *dev);
+void input_unregister_device(struct input_dev *dev);
+void input_set_capability(struct input_dev *dev, unsigned int type,
+		unsigned int code);
+void input_event(struct input_dev *dev, unsigned int type,
+		unsigned int code, int value);
+
+static inline void input_report_key(struct input_dev *dev,
+		unsigned int code, int value)
+{
+	input_event(dev, EV_KEY, code, !!value);
+}
+
+static inline void input_report_switch(struct input_dev *dev,
+		unsigned int code, int value)
+{
+	input_event(dev, EV_SW, code, !!value);
+}
+
+static inline void input_sync(struct input_dev *dev)
+{
+	input_event(dev, EV_SYN, SYN_REPORT, 0);
+}
+
+/* acpi */
+
+typedef unsigned int acpi_status;
+typedef void *acpi_handle;
+
+#define AE_OK		0
+#define AE_ERROR	1
+#define AE_NOT_FOUND	5
+#define ACPI_FAILURE(s)	((s) != AE_OK)
+
+#define METHOD_NAME__CRS "_CRS"
+
+#define ACPI_RESOURCE_TYPE_IRQ		0
+#define ACPI_RESOURCE_TYPE_IO		1
+#define ACPI_RESOURCE_TYPE_END_TAG	7
+
+struct acpi_resource {
+	u32 type;
+	union {
+		struct {
+			u8 interrupts[1];
+		} irq;
+		struct {
+			u16 minimum;
+			u8 address_length;
+		} io;
+	} data;
+};
+
+typedef acpi_status (*acpi_walk_resource_callback)(struct acpi_resource *,
+		void *);
+
+acpi_status acpi_walk_resources(acpi_handle handle, const char *name,
+		acpi_walk_resource_callback cb, void *context);
+
+struct acpi_device_id {
+	const char *id;
+};
+
+struct acpi_device {
+	acpi_handle handle;
+	void *driver_data;
+	struct device dev;
+	struct {
+		char hardware_id[9];
+		char device_name[40];
+		char device_class[20];
+	} pnp;
+};
+
+#define acpi_driver_data(d)	((d)->driver_data)
+#define to_acpi_device(d)	container_of(d, struct acpi_device, dev)
+#define acpi_device_name(d)	((d)->pnp.device_name)
+#define acpi_device_class(d)	((d)->pnp.device_class)
+#define acpi_device_hid(d)	((const char *)(d)->pnp.hardware_id)
+
+struct acpi_driver {
+	const char *name;
+	const char *class;
+	const struct acpi_device_id *ids;
+	struct {
+		int (*add)(struct acpi_device *);
+		int (*remove)(struct acpi_device *, int);
+		int (*resume)(struct acpi_device *);
+	} ops;
+};
+
+int acpi_bus_register_driver(struct acpi_driver *driver);
+void acpi_bus_unregister_driver(struct acpi_driver *driver);
+
+/* dmi */
+
+enum dmi_field {
+	DMI_NONE,
+	DMI_SYS_VENDOR,
+	DMI_PRODUCT_NAME,
+	DMI_STRING_MAX
+};
+
+struct dmi_strmatch {
+	unsigned char slot;
+	char substr[79];
+};
+
+struct dmi_system_id {
+	int (*callback)(const struct dmi_system_id *);
+	const char *ident;
+	struct dmi_strmatch matches[4];
+	void *driver_data;
+};
+
+#define DMI_MATCH(a, b)	{ .slot = a, .substr = b }
+
+int dmi_check_system(const struct dmi_system_id *list);
+
+/* files and locking */
+
+#define __user
+
+struct file {
+	void *private_data;
+};
+
+struct inode {
+	void *i_private;
+};
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *, struct file *);
+	ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+	loff_t (*llseek)(struct file *, loff_t, int);
+	int (*release)(struct inode *, struct file *);
+};
+
+#define no_llseek	NULL
+#define seq_lseek	NULL
+
+/* the whole output is generated by the first read */
+struct seq_file {
+	char buf[4096];
+	size_t count;
+	int (*show)(struct seq_file *m, void *v);
+	void *private;
+};
+
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data);
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		loff_t *ppos);
+int single_release(struct inode *inode, struct file *file);
+
+static inline unsigned long copy_from_user(void *to,
+		const void __user *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+/* the simulation is single threaded */
+struct mutex {
+	int locked;
+};
+
+#define mutex_init(m)	((m)->locked = 0)
+#define mutex_lock(m)	((m)->locked++)
+#define mutex_unlock(m)	((m)->locked--)
+
+/* debugfs */
+
+#define S_IRUGO		(S_IRUSR | S_IRGRP | S_IROTH)
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_u32(const char *name, unsigned short mode,
+		struct dentry *parent, u32 *value);
+struct dentry *debugfs_create_file(const char *name, unsigned short mode,
+		struct dentry *parent, void *data,
+		const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+/* sysfs */
+
+struct attribute {
+	const char *name;
+	unsigned short mode;
+};
+
+struct bin_attribute {
+	struct attribute attr;
+	size_t size;
+	ssize_t (*read)(struct file *, struct kobject *,
+			struct bin_attribute *, char *, loff_t, size_t);
+	ssize_t (*write)(struct file *, struct kobject *,
+			struct bin_attribute *, char *, loff_t, size_t);
+};
+
+int sysfs_create_bin_file(struct kobject *kobj,
+		const struct bin_attribute *attr);
+void sysfs_remove_bin_file(struct kobject *kobj,
+		const struct bin_attribute *attr);
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr,
+			char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t count);
+};
+
+#define DEVICE_ATTR(_name, _mode, _show, _store) \
+	struct device_attribute dev_attr_##_name = \
+		{ { #_name, _mode }, _show, _store }
+
+int device_create_file(struct device *dev,
+		const struct device_attribute *attr);
+void device_remove_file(struct device *dev,
+		const struct device_attribute *attr);
+
+/* only groups of device attributes */
+struct attribute_group {
+	struct attribute **attrs;
+};
+
+int sysfs_create_group(struct kobject *kobj,
+		const struct attribute_group *grp);
+void sysfs_remove_group(struct kobject *kobj,
+		const struct attribute_group *grp);
+
+/* both are logged, see the uevent command */
+void sysfs_notify(struct kobject *kobj, const char *dir, const char *attr);
+
+enum kobject_action {
+	KOBJ_ADD,
+	KOBJ_REMOVE,
+	KOBJ_CHANGE,
+};
+
+int kobject_uevent_env(struct kobject *kobj, enum kobject_action action,
+		char *envp[]);
+
+static inline int strtobool(const char *s, bool *res)
+{
+	switch (s[0]) {
+	case 'y': case 'Y': case '1':
+		*res = true;
+		return 0;
+	case 'n': case 'N': case '0':
+		*res = false;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+/* like the kernel, a trailing newline is accepted */
+static inline int kstrtouint(const char *s, unsigned int base,
+		unsigned int *res)
+{
+	unsigned long v;
+	char *end;
+
+	errno = 0;
+	v = strtoul(s, &end, base);
+	if (end == s || errno || v > UINT_MAX || s[0] == '-')
+		return -EINVAL;
+	if (*end == '\n')
+		end++;
+	if (*end)
+		return -EINVAL;
+
+	*res = v;
+	return 0;
+}
+
+/* tracepoints are compiled out */
+
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+
+#endif /* _FUJITSU_TABLET_SIM_H */
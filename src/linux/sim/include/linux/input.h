@@ -0,0 +1,5 @@
+/* kernel headers */
+#include_next <linux/input.h>
+
+/* see fujitsu-tablet-sim.h */
+#include <fujitsu-tablet-sim.h>
@@ -0,0 +1,2 @@
+/* see fujitsu-tablet-sim.h */
+#include <fujitsu-tablet-sim.h>
@@ -0,0 +1 @@
+/* tracepoints are compiled out, nothing to define */